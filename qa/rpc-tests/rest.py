@@ -10,6 +10,7 @@
 from test_framework import BitcoinTestFramework
 from util import *
 import json
+import time
 
 try:
     import http.client as httplib
@@ -33,6 +34,9 @@ def http_get_call(host, port, path, response_object = 0):
 class RESTTest (BitcoinTestFramework):
     FORMAT_SEPARATOR = "."
     
+    def setup_nodes(self):
+        return start_nodes(4, self.options.tmpdir, [ ['-addrindex'], None, None, None ])
+
     def run_test(self):
         url = urlparse.urlparse(self.nodes[0].url)
         bb_hash = self.nodes[0].getbestblockhash()
@@ -82,8 +86,50 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
-                
-        
+
+        # check the address endpoints, once the index caught up
+        while not self.nodes[0].getaddrindexinfo()['synced']:
+            time.sleep(0.1)
+        address = self.nodes[2].getnewaddress()
+        txs = []
+        for i in range(3):
+            txs.append(self.nodes[0].sendtoaddress(address, 1+i))
+        self.sync_all()
+        self.nodes[1].setgenerate(True, 1)
+        self.sync_all()
+        while self.nodes[0].getaddrindexinfo()['height'] != self.nodes[0].getblockcount():
+            time.sleep(0.1)
+
+        # pages hold at most limit entries, and name the next page
+        json_string = http_get_call(url.hostname, url.port, '/rest/address/'+address+'/txs'+self.FORMAT_SEPARATOR+'json?limit=2')
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj['txs']), 2)
+        found = [tx['txid'] for tx in json_obj['txs']]
+        next_page = json_obj['next']
+        json_string = http_get_call(url.hostname, url.port, '/rest/address/'+address+'/txs'+self.FORMAT_SEPARATOR+'json?limit=2&from_height=%d&from_index=%d' % (next_page['from_height'], next_page['from_index']))
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj['txs']), 1)
+        assert_equal('next' in json_obj, False)
+        found += [tx['txid'] for tx in json_obj['txs']]
+        assert_equal(sorted(found), sorted(txs))
+
+        json_string = http_get_call(url.hostname, url.port, '/rest/address/'+address+'/utxos'+self.FORMAT_SEPARATOR+'json?limit=2')
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj['utxos']), 2)
+        found = [utxo['txid'] for utxo in json_obj['utxos']]
+        json_string = http_get_call(url.hostname, url.port, '/rest/address/'+address+'/utxos'+self.FORMAT_SEPARATOR+'json?limit=2&after_outpoint='+json_obj['next']['after_outpoint'])
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj['utxos']), 1)
+        found += [utxo['txid'] for utxo in json_obj['utxos']]
+        assert_equal(sorted(found), sorted(txs))
+
+        response = http_get_call(url.hostname, url.port, '/rest/address/'+address+'/txs'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_greater_than(int(response.getheader('content-length')), 10)
+
+        response = http_get_call(url.hostname, url.port, '/rest/address/'+address+'/utxos'+self.FORMAT_SEPARATOR+'json?after_outpoint=invalid', True)
+        assert_equal(response.status, 400)
+
 
 if __name__ == '__main__':
     RESTTest ().main ()
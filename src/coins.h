@@ -7,6 +7,7 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "serialize.h"
 #include "uint256.h"
 #include "undo.h"
@@ -256,6 +257,15 @@ public:
                 return false;
         return true;
     }
+
+    //! Heap memory taken by the outputs and their scripts
+    size_t DynamicMemoryUsage() const {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH(const CTxOut &out, vout) {
+            ret += memusage::DynamicUsage(*static_cast<const std::vector<unsigned char>*>(&out.scriptPubKey));
+        }
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -300,6 +310,10 @@ struct CCoinsStats
     uint64_t nSerializedSize;
     uint256 hashSerialized;
     CAmount nTotalAmount;
+    //! unspent outputs by script type, indexed by txnouttype
+    std::vector<uint64_t> vScriptTypeCount;
+    //! unspent outputs by value: those of 0 satoshis at 0, and those from 10^(i-1) to below 10^i satoshis at i
+    std::vector<uint64_t> vValueCount;
 
     CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0) {}
 };
@@ -343,6 +357,7 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
+    CCoinsView *GetBackend() const { return base; }
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
 };
@@ -360,7 +375,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -383,6 +399,9 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -408,6 +427,15 @@ public:
      */
     CCoinsModifier ModifyCoins(const uint256 &txid);
 
+    //! Check whether coins for the given txid are cached, without fetching them from the base view
+    bool HaveCoinsInCache(const uint256 &txid) const;
+
+    /**
+     * Add coins, which were read from the base view ahead of time (possibly on other threads),
+     * unless there are coins for txid in the cache already. The coins are swapped out.
+     */
+    void AddFetchedCoins(const uint256 &txid, CCoins &coins);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
@@ -418,6 +446,9 @@ public:
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the heap memory taken by the cache: the map with its buckets, and the coins in it
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -441,6 +472,7 @@ public:
 private:
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
+    CCoinsMap::iterator InsertFetchedCoins(const uint256 &txid, CCoins &coins) const;
 };
 
 #endif // BITCOIN_COINS_H
@@ -0,0 +1,222 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinscompact.h"
+
+#include "clientversion.h"
+#include "streams.h"
+#include "uint256.h"
+
+#include <algorithm>
+#include <string.h>
+
+// Offsets are kept in 32 bits, next to the EMPTY and DELETED markers
+static const size_t MAX_COMPACT_MAP_SIZE = (size_t)1 << 31;
+static const size_t MIN_TABLE_SIZE = 1 << 10;
+static const size_t MIN_ARENA_SIZE = 1 << 16;
+
+const uint32_t CCoinsCompactMap::EMPTY;
+const uint32_t CCoinsCompactMap::DELETED;
+const size_t CCoinsCompactMap::ENTRY_HEADER_SIZE;
+
+CCoinsCompactMap::CCoinsCompactMap(size_t nMaxSizeIn) : nEntries(0), nDeleted(0), nGarbage(0)
+{
+    nMaxSize = std::min(nMaxSizeIn, MAX_COMPACT_MAP_SIZE);
+    table.assign(MIN_TABLE_SIZE, EMPTY);
+}
+
+size_t CCoinsCompactMap::Find(const uint256 &txid) const
+{
+    size_t nMask = table.size() - 1;
+    for (size_t nSlot = hasher(txid) & nMask; ; nSlot = (nSlot + 1) & nMask) {
+        uint32_t nValue = table[nSlot];
+        if (nValue == EMPTY)
+            return table.size();
+        if (nValue != DELETED && memcmp(&arena[nValue - 1], txid.begin(), 32) == 0)
+            return nSlot;
+    }
+}
+
+void CCoinsCompactMap::Insert(const uint256 &txid, size_t nOffset)
+{
+    size_t nMask = table.size() - 1;
+    size_t nSlot = hasher(txid) & nMask;
+    while (table[nSlot] != EMPTY && table[nSlot] != DELETED)
+        nSlot = (nSlot + 1) & nMask;
+    if (table[nSlot] == DELETED)
+        nDeleted--;
+    table[nSlot] = nOffset + 1;
+    nEntries++;
+}
+
+size_t CCoinsCompactMap::GetEntrySize(size_t nOffset) const
+{
+    uint32_t nSize;
+    memcpy(&nSize, &arena[nOffset + 32], 4);
+    return ENTRY_HEADER_SIZE + nSize;
+}
+
+void CCoinsCompactMap::Rebuild(size_t nKeepFrom, size_t nTableSize)
+{
+    std::vector<uint32_t> vOffset;
+    vOffset.reserve(nEntries);
+    for (size_t i = 0; i < table.size(); i++) {
+        if (table[i] != EMPTY && table[i] != DELETED && table[i] - 1 >= nKeepFrom)
+            vOffset.push_back(table[i] - 1);
+    }
+    std::sort(vOffset.begin(), vOffset.end());
+
+    // entries only move towards the front of the arena, in their order
+    table.assign(nTableSize, EMPTY);
+    nEntries = 0;
+    nDeleted = 0;
+    size_t nPos = 0;
+    for (std::vector<uint32_t>::const_iterator it = vOffset.begin(); it != vOffset.end(); ++it) {
+        size_t nSize = GetEntrySize(*it);
+        if (nPos != *it)
+            memmove(&arena[nPos], &arena[*it], nSize);
+        uint256 txid;
+        memcpy(txid.begin(), &arena[nPos], 32);
+        Insert(txid, nPos);
+        nPos += nSize;
+    }
+    arena.resize(nPos);
+    nGarbage = 0;
+}
+
+bool CCoinsCompactMap::Reserve(size_t nSize)
+{
+    // keep the table at most half full
+    if ((nEntries + nDeleted + 1) * 2 > table.size()) {
+        size_t nTableSize = table.size();
+        if ((nEntries + 1) * 4 > nTableSize)
+            nTableSize *= 2;
+        if (arena.capacity() + nTableSize * sizeof(uint32_t) > nMaxSize) {
+            Rebuild(arena.size() / 2, table.size());
+            return Reserve(nSize);
+        }
+        Rebuild(0, nTableSize);
+    }
+
+    if (arena.size() + nSize <= arena.capacity())
+        return true;
+    size_t nCapacity = std::max(arena.capacity() * 2, MIN_ARENA_SIZE);
+    while (nCapacity < arena.size() + nSize)
+        nCapacity *= 2;
+    if (nCapacity + table.capacity() * sizeof(uint32_t) <= nMaxSize) {
+        arena.reserve(nCapacity);
+        return true;
+    }
+
+    // The map is full: drop the garbage, if that frees up most of the arena, or the older
+    // half of the entries otherwise.
+    Rebuild(nGarbage * 2 >= arena.size() ? 0 : arena.size() / 2, table.size());
+    return arena.size() + nSize <= arena.capacity();
+}
+
+bool CCoinsCompactMap::Get(const uint256 &txid, CCoins &coins) const
+{
+    size_t nSlot = Find(txid);
+    if (nSlot == table.size())
+        return false;
+    size_t nOffset = table[nSlot] - 1;
+    const char *pbegin = (const char*)&arena[nOffset + ENTRY_HEADER_SIZE];
+    CMemoryReader reader(pbegin, (const char*)&arena[nOffset] + GetEntrySize(nOffset), SER_DISK, CLIENT_VERSION);
+    reader >> coins;
+    return true;
+}
+
+bool CCoinsCompactMap::Have(const uint256 &txid) const
+{
+    return Find(txid) != table.size();
+}
+
+void CCoinsCompactMap::Put(const uint256 &txid, const CCoins &coins)
+{
+    Erase(txid);
+    if (coins.IsPruned())
+        return;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << coins;
+    size_t nSize = ENTRY_HEADER_SIZE + ss.size();
+    // entries, which would take much of the map, are not kept
+    if (nSize > nMaxSize / 16 || !Reserve(nSize))
+        return;
+
+    size_t nOffset = arena.size();
+    uint32_t nDataSize = ss.size();
+    arena.insert(arena.end(), txid.begin(), txid.end());
+    arena.insert(arena.end(), (const unsigned char*)&nDataSize, (const unsigned char*)&nDataSize + 4);
+    arena.insert(arena.end(), (const unsigned char*)&ss[0], (const unsigned char*)&ss[0] + ss.size());
+    Insert(txid, nOffset);
+}
+
+void CCoinsCompactMap::Erase(const uint256 &txid)
+{
+    size_t nSlot = Find(txid);
+    if (nSlot == table.size())
+        return;
+    nGarbage += GetEntrySize(table[nSlot] - 1);
+    table[nSlot] = DELETED;
+    nEntries--;
+    nDeleted++;
+}
+
+void CCoinsCompactMap::Clear()
+{
+    std::vector<unsigned char>().swap(arena);
+    table.assign(MIN_TABLE_SIZE, EMPTY);
+    std::vector<uint32_t>(table).swap(table);
+    nEntries = 0;
+    nDeleted = 0;
+    nGarbage = 0;
+}
+
+CCoinsViewCompact::CCoinsViewCompact(CCoinsView *baseIn, size_t nMaxSize) : CCoinsViewBacked(baseIn), map(nMaxSize) { }
+
+bool CCoinsViewCompact::GetCoins(const uint256 &txid, CCoins &coins) const
+{
+    {
+        LOCK(cs);
+        if (map.Get(txid, coins))
+            return true;
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewCompact::HaveCoins(const uint256 &txid) const
+{
+    {
+        LOCK(cs);
+        if (map.Have(txid))
+            return true;
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewCompact::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    {
+        LOCK(cs);
+        for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+            // unmodified coins were read from the base view, and may be kept already
+            if (!(it->second.flags & CCoinsCacheEntry::DIRTY) && map.Have(it->first))
+                continue;
+            map.Put(it->first, it->second.coins);
+        }
+    }
+    return base->BatchWrite(mapCoins, hashBlock);
+}
+
+size_t CCoinsViewCompact::GetCount() const
+{
+    LOCK(cs);
+    return map.GetCount();
+}
+
+size_t CCoinsViewCompact::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return map.DynamicMemoryUsage();
+}
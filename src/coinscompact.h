@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSCOMPACT_H
+#define BITCOIN_COINSCOMPACT_H
+
+#include "coins.h"
+#include "sync.h"
+
+#include <stdint.h>
+#include <vector>
+
+class uint256;
+
+/**
+ * Map from txids to coins, which keeps the coins in their compressed serialization, one after
+ * the other in a single buffer (the arena), and finds them by open addressing. An entry takes
+ * its serialized size, the txid and a slot of the table, rather than a CCoins with a heap
+ * allocation per output script. Replaced and erased entries leave garbage in the arena, until
+ * it is compacted. Once the map would exceed its maximal size, the older half of the entries
+ * is dropped.
+ */
+class CCoinsCompactMap
+{
+private:
+    //! entries: txid, size of the serialized coins (4 bytes), serialized coins
+    std::vector<unsigned char> arena;
+    //! arena offsets of entries plus one, or EMPTY or DELETED
+    std::vector<uint32_t> table;
+    size_t nEntries;
+    size_t nDeleted;    //! deleted slots in the table
+    size_t nGarbage;    //! bytes of replaced and erased entries in the arena
+    size_t nMaxSize;
+    CCoinsKeyHasher hasher;
+
+    static const uint32_t EMPTY = 0;
+    static const uint32_t DELETED = 0xFFFFFFFF;
+    static const size_t ENTRY_HEADER_SIZE = 36;
+
+    //! Slot of txid, or the end of the table if it is not found
+    size_t Find(const uint256 &txid) const;
+    //! Add an entry, whose txid is not in the table
+    void Insert(const uint256 &txid, size_t nOffset);
+    size_t GetEntrySize(size_t nOffset) const;
+    //! Rebuild the table with nTableSize slots, and compact the arena, keeping the entries from nKeepFrom on
+    void Rebuild(size_t nKeepFrom, size_t nTableSize);
+    //! Make room for an entry of nSize bytes
+    bool Reserve(size_t nSize);
+
+public:
+    CCoinsCompactMap(size_t nMaxSizeIn);
+
+    bool Get(const uint256 &txid, CCoins &coins) const;
+    bool Have(const uint256 &txid) const;
+    //! Add or replace the coins of txid. Pruned coins are erased.
+    void Put(const uint256 &txid, const CCoins &coins);
+    void Erase(const uint256 &txid);
+    void Clear();
+
+    size_t GetCount() const { return nEntries; }
+    //! Memory taken by the arena and the table
+    size_t DynamicMemoryUsage() const { return arena.capacity() + table.capacity() * sizeof(uint32_t); }
+};
+
+/**
+ * Cache of the coins of its base view in a CCoinsCompactMap, which sits below the coins cache
+ * of the chain tip. It keeps the coins written through it, and those read and passed back by
+ * that cache when it is flushed, so that they are found in memory after the flush. Coins may
+ * be read on several threads at once.
+ */
+class CCoinsViewCompact : public CCoinsViewBacked
+{
+private:
+    mutable CCriticalSection cs;
+    CCoinsCompactMap map;
+
+public:
+    CCoinsViewCompact(CCoinsView *baseIn, size_t nMaxSize);
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    size_t GetCount() const;
+    size_t DynamicMemoryUsage() const;
+};
+
+#endif // BITCOIN_COINSCOMPACT_H
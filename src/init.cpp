@@ -12,6 +12,7 @@
 #include "addrman.h"
 #include "amount.h"
 #include "checkpoints.h"
+#include "coinscompact.h"
 #include "compat/sanity.h"
 #include "key.h"
 #include "main.h"
@@ -176,12 +177,18 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinscompact;
+        pcoinscompact = NULL;
+        delete pcoinswriter;
+        pcoinswriter = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete paddrindex;
+        paddrindex = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -240,10 +247,14 @@ std::string HelpMessage(HelpMessageMode mode)
     // When adding new options to the categories, please keep and ensure alphabetical ordering.
     string strUsage = _("Options:") + "\n";
     strUsage += "  -?                     " + _("This help message") + "\n";
+    strUsage += "  -addrindex             " + strprintf(_("Maintain an address index, used by the searchrawtransactions rpc call (default: %u)"), 0) + "\n";
+    strUsage += "  -addrindexpushes       " + strprintf(_("Also index the data pushes of output scripts, instead of only the key and script ids of standard scripts (default: %u)"), 0) + "\n";
     strUsage += "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)") + "\n";
+    strUsage += "  -backgroundflush       " + strprintf(_("Write the in-memory coin cache to the database on a background thread when it is flushed (default: %u)"), DEFAULT_BACKGROUND_FLUSH) + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -checkblocks=<n>       " + strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288) + "\n";
     strUsage += "  -checklevel=<n>        " + strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3) + "\n";
+    strUsage += "  -compactcoincache      " + strprintf(_("Keep half of the in-memory coin cache in compressed form, which holds several times as many coins, and is kept when the cache is flushed (default: %u)"), DEFAULT_COMPACT_COIN_CACHE) + "\n";
     strUsage += "  -conf=<file>           " + strprintf(_("Specify configuration file (default: %s)"), "bitcoin.conf") + "\n";
     if (mode == HMM_BITCOIND)
     {
@@ -255,6 +266,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache) + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
+#ifndef WIN32
+    strUsage += "  -mmapblocks            " + strprintf(_("Map completed block files into memory to read blocks and transactions from them (default: %u)"), 0) + "\n";
+#endif
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
 #ifndef WIN32
     strUsage += "  -pid=<file>            " + strprintf(_("Specify pid file (default: %s)"), "bitcoind.pid") + "\n";
@@ -659,6 +673,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     // Checkmempool and checkblockindex default to true in regtest mode
     mempool.setSanityCheck(GetBoolArg("-checkmempool", Params().DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
+    // Mapping block files needs a large address space
+    fMapBlockFiles = GetBoolArg("-mmapblocks", false) && sizeof(void*) >= 8;
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
@@ -786,9 +802,13 @@ bool AppInit2(boost::thread_group& threadGroup)
     std::ostringstream strErrors;
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    // Each script check thread is paired with one, which reads the coins of blocks ahead
+    // of their connection, and waits on the coins database most of the time.
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
+        }
     }
 
     /* Start the RPC server already.  It will be started in "warmup" mode
@@ -991,12 +1011,19 @@ bool AppInit2(boost::thread_group& threadGroup)
     else if (nTotalCache > (nMaxDbCache << 20))
         nTotalCache = (nMaxDbCache << 20); // total cache cannot be greater than nMaxDbCache
     size_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false) && !GetBoolArg("-addrindex", false))
+    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
         nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
-    nTotalCache -= nBlockTreeDBCache;
+    size_t nAddrIndexDBCache = 0;
+    if (GetBoolArg("-addrindex", false))
+        nAddrIndexDBCache = nTotalCache / 8; // the address index db takes the share the block tree db had with it
+    nTotalCache -= nBlockTreeDBCache + nAddrIndexDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    size_t nCoinCompactCache = 0;
+    if (GetBoolArg("-compactcoincache", DEFAULT_COMPACT_COIN_CACHE))
+        nCoinCompactCache = nTotalCache / 2; // the compact coin cache takes half of the remaining cache
+    nTotalCache -= nCoinCompactCache;
+    nCoinCacheUsage = nTotalCache; // the coins cache takes the rest, measured by its memory usage
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1010,14 +1037,34 @@ bool AppInit2(boost::thread_group& threadGroup)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinscompact;
+                pcoinscompact = NULL;
+                delete pcoinswriter;
+                pcoinswriter = NULL;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete paddrindex;
+                paddrindex = NULL;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                if (nAddrIndexDBCache > 0) {
+                    TryCreateDirectory(GetDataDir() / "indexes");
+                    paddrindex = new CAddrIndexDB(nAddrIndexDBCache, false, fReindex);
+                }
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                CCoinsView *pcoinsbase = pcoinscatcher;
+                if (GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH)) {
+                    pcoinswriter = new CCoinsViewDBWriter(pcoinscatcher, pcoinsdbview);
+                    pcoinsbase = pcoinswriter;
+                }
+                if (nCoinCompactCache > 0) {
+                    pcoinscompact = new CCoinsViewCompact(pcoinsbase, nCoinCompactCache);
+                    pcoinsTip = new CCoinsViewCache(pcoinscompact);
+                } else {
+                    pcoinsTip = new CCoinsViewCache(pcoinsbase);
+                }
 
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
@@ -1044,18 +1091,36 @@ bool AppInit2(boost::thread_group& threadGroup)
                     break;
                 }
 
-                // Check for changed -addrindex state
-                if (fAddrIndex != GetBoolArg("-addrindex", false)) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -addrindex");
+                // Check for changed -addrindex state. Enabling it does not require a reindex,
+                // as the index is built from the block and undo files in the background.
+                if (fAddrIndex && !GetBoolArg("-addrindex", false)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to disable -addrindex");
                     break;
                 }
+                bool fAddrIndexPushesArg = GetBoolArg("-addrindexpushes", false);
+                if (!fAddrIndex && GetBoolArg("-addrindex", false) && !EnableAddrIndex(fAddrIndexPushesArg)) {
+                    strLoadError = _("Error enabling address index");
+                    break;
+                }
+                if (fAddrIndex && fAddrIndexPushes != fAddrIndexPushesArg) {
+                    LogPrintf("Rebuilding address index %s data pushes...\n", fAddrIndexPushesArg ? "with" : "without");
+                    if (!EnableAddrIndex(fAddrIndexPushesArg)) {
+                        strLoadError = _("Error changing address index");
+                        break;
+                    }
+                }
 
                 uiInterface.InitMessage(_("Verifying blocks..."));
-                if (!CVerifyDB().VerifyDB(pcoinsdbview, GetArg("-checklevel", 3),
+                if (!CVerifyDB().VerifyDB(pcoinsbase, GetArg("-checklevel", 3),
                               GetArg("-checkblocks", 288))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
+
+                if (!InitAddrIndex()) {
+                    strLoadError = _("Error loading address index");
+                    break;
+                }
             } catch(std::exception &e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1255,6 +1320,8 @@ bool AppInit2(boost::thread_group& threadGroup)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (fAddrIndex)
+        threadGroup.create_thread(&ThreadAddrIndexSync);
     if (chainActive.Tip() == NULL) {
         LogPrintf("Waiting for genesis block to be imported...\n");
         while (!fRequestShutdown && chainActive.Tip() == NULL)
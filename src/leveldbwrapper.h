@@ -61,6 +61,23 @@ public:
     }
 };
 
+/** Consistent, read-only state of a database at the time the snapshot was taken */
+class CLevelDBSnapshot
+{
+private:
+    CLevelDBSnapshot(const CLevelDBSnapshot&);
+    void operator=(const CLevelDBSnapshot&);
+
+    leveldb::DB* pdb;
+    const leveldb::Snapshot* psnapshot;
+
+public:
+    CLevelDBSnapshot(leveldb::DB* pdbIn) : pdb(pdbIn), psnapshot(pdbIn->GetSnapshot()) {}
+    ~CLevelDBSnapshot() { pdb->ReleaseSnapshot(psnapshot); }
+
+    const leveldb::Snapshot* Get() const { return psnapshot; }
+};
+
 class CLevelDBWrapper
 {
 private:
@@ -90,15 +107,18 @@ public:
     ~CLevelDBWrapper();
 
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const throw(leveldb_error)
+    bool Read(const K& key, V& value, const CLevelDBSnapshot* psnapshot = NULL) const throw(leveldb_error)
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
+        leveldb::ReadOptions options = readoptions;
+        if (psnapshot)
+            options.snapshot = psnapshot->Get();
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -164,9 +184,45 @@ public:
     }
 
     // not exactly clean encapsulation, but it's easiest for now
-    leveldb::Iterator* NewIterator()
+    leveldb::Iterator* NewIterator(const CLevelDBSnapshot* psnapshot = NULL)
+    {
+        leveldb::ReadOptions options = iteroptions;
+        if (psnapshot)
+            options.snapshot = psnapshot->Get();
+        return pdb->NewIterator(options);
+    }
+
+    //! Estimate the size on disk of the entries with keys in [key_begin, key_end), not counting recent writes in memory
+    template <typename K>
+    uint64_t EstimateSize(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(&ssKey1[0], ssKey1.size());
+        leveldb::Slice slKey2(&ssKey2[0], ssKey2.size());
+        leveldb::Range range(slKey1, slKey2);
+        uint64_t nSize = 0;
+        pdb->GetApproximateSizes(&range, 1, &nSize);
+        return nSize;
+    }
+
+    //! Compact the entries with keys in [key_begin, key_end], which may take a while
+    template <typename K>
+    void CompactRange(const K& key_begin, const K& key_end)
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(&ssKey1[0], ssKey1.size());
+        leveldb::Slice slKey2(&ssKey2[0], ssKey2.size());
+        pdb->CompactRange(&slKey1, &slKey2);
+    }
+
+    //! Take a snapshot, which reads see unaffected by later writes, as long as it is kept
+    CLevelDBSnapshot* NewSnapshot()
     {
-        return pdb->NewIterator(iteroptions);
+        return new CLevelDBSnapshot(pdb);
     }
 };
 
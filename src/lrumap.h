@@ -0,0 +1,86 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LRUMAP_H
+#define BITCOIN_LRUMAP_H
+
+#include <list>
+#include <map>
+
+/**
+ * STL-like map container that only keeps the most recently used elements, up to a total
+ * cost. Every element costs one by default, which limits the number of elements.
+ */
+template <typename K, typename V>
+class lrumap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef typename std::map<K, V>::size_type size_type;
+
+protected:
+    struct entry {
+        V value;
+        size_t nCost;
+        typename std::list<K>::iterator itUse;
+    };
+    std::map<K, entry> map;
+    std::list<K> listUse; //! keys, most recently used first
+    size_t nCost;
+    size_t nMaxCost;
+
+public:
+    lrumap(size_t nMaxCostIn = 0) : nCost(0), nMaxCost(nMaxCostIn) {}
+    size_type size() const { return map.size(); }
+    bool empty() const { return map.empty(); }
+    size_t cost() const { return nCost; }
+    size_t max_cost() const { return nMaxCost; }
+    size_type count(const key_type& k) const { return map.count(k); }
+
+    /** Find the value of k and mark it as most recently used. The pointer is valid until the next change. */
+    const mapped_type* get(const key_type& k)
+    {
+        typename std::map<K, entry>::iterator it = map.find(k);
+        if (it == map.end())
+            return NULL;
+        listUse.splice(listUse.begin(), listUse, it->second.itUse);
+        return &it->second.value;
+    }
+
+    /** Insert or replace the value of k, and evict the least recently used elements above the maximal cost */
+    void insert(const key_type& k, const mapped_type& v, size_t nCostIn = 1)
+    {
+        erase(k);
+        if (nMaxCost && nCostIn > nMaxCost)
+            return;
+        listUse.push_front(k);
+        entry& e = map[k];
+        e.value = v;
+        e.nCost = nCostIn;
+        e.itUse = listUse.begin();
+        nCost += nCostIn;
+        while (nMaxCost && nCost > nMaxCost)
+            erase(listUse.back());
+    }
+
+    void erase(const key_type& k)
+    {
+        typename std::map<K, entry>::iterator it = map.find(k);
+        if (it == map.end())
+            return;
+        nCost -= it->second.nCost;
+        listUse.erase(it->second.itUse);
+        map.erase(it);
+    }
+
+    void clear()
+    {
+        map.clear();
+        listUse.clear();
+        nCost = 0;
+    }
+};
+
+#endif // BITCOIN_LRUMAP_H
@@ -12,6 +12,7 @@
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "init.h"
+#include "lrumap.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "pow.h"
@@ -24,8 +25,10 @@
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace boost;
@@ -44,6 +47,7 @@ CCriticalSection cs_main;
 BlockMap mapBlockIndex;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
+CBlockIndex *pindexAddrIndexBest = NULL;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
@@ -52,9 +56,12 @@ bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
 bool fAddrIndex = false;
+/** Whether the address index holds the data pushes of output scripts, besides their key and script ids */
+bool fAddrIndexPushes = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+bool fMapBlockFiles = false;
+size_t nCoinCacheUsage = 5000 * 300;
 
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
@@ -71,6 +78,7 @@ map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
 void EraseOrphansFor(NodeId peer);
 
 static void CheckBlockIndex();
+static bool FlushAddrIndex(CValidationState &state);
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -152,6 +160,15 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /**
+     * Address index changes of the blocks after pindexAddrIndexWritten up to pindexAddrIndexBest,
+     * which are not written yet, in the order of the blocks. Each of them is sorted, and never
+     * modified, so that views of the index can share them. Protected by cs_main.
+     */
+    std::vector<boost::shared_ptr<const CAddrIndexUpdate> > vAddrIndexPending;
+    size_t nAddrIndexPendingCount = 0;
+    CBlockIndex *pindexAddrIndexWritten = NULL;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -544,7 +561,10 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewCompact *pcoinscompact = NULL;
+CCoinsViewDBWriter *pcoinswriter = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CAddrIndexDB *paddrindex = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1099,8 +1119,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
+        // Collect the address ids of the transaction, while its inputs are in view
+        std::vector<uint160> vAddrId;
+        if (fAddrIndex) {
+            BOOST_FOREACH(const CTxIn &txin, tx.vin)
+                ExtractAddrIndexIds(view.GetOutputFor(txin).scriptPubKey, vAddrId);
+            BOOST_FOREACH(const CTxOut &txout, tx.vout)
+                ExtractAddrIndexIds(txout.scriptPubKey, vAddrId);
+        }
+
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, vAddrId);
     }
 
     SyncWithWallets(tx, NULL);
@@ -1108,24 +1137,203 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return true;
 }
 
-bool ReadTransaction(CTransaction& tx, const CDiskTxPos &pos, uint256 &hashBlock) {
-    CAutoFile file(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (file.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-    CBlockHeader header;
+namespace {
+
+/** Number of block files kept open for reading transactions */
+const size_t MAX_TX_READ_FILES = 8;
+/** Number of block hashes, and serialized size of transactions, kept after reading transactions */
+const size_t MAX_TX_READ_HASHES = 10000;
+const size_t MAX_TX_READ_CACHE = 16 << 20;
+
+/** Number of completed block files kept mapped into memory */
+const size_t MAX_MAPPED_BLOCK_FILES = 16;
+
+/** Read-only mapping of a completed block file, unmapped when the last reader drops it */
+class CMappedBlockFile
+{
+private:
+    CMappedBlockFile(const CMappedBlockFile&);
+    CMappedBlockFile& operator=(const CMappedBlockFile&);
+
+public:
+    const char *pbegin;
+    size_t nSize;
+
+    CMappedBlockFile(const char *pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+    ~CMappedBlockFile() { UnmapFile(pbegin, nSize); }
+};
+
+CCriticalSection cs_mappedfiles;
+lrumap<int, boost::shared_ptr<CMappedBlockFile> > mapMappedBlockFiles(MAX_MAPPED_BLOCK_FILES);
+
+/**
+ * Get the mapping of the block file holding pos, or an empty pointer if block files are not mapped,
+ * the file may still grow, or pos lies beyond the mapping. Readers deserialize from the mapping
+ * without holding any lock.
+ */
+boost::shared_ptr<CMappedBlockFile> GetMappedBlockFile(const CDiskBlockPos &pos)
+{
+    const int nFile = pos.nFile;
+    if (!fMapBlockFiles)
+        return boost::shared_ptr<CMappedBlockFile>();
+    {
+        LOCK(cs_LastBlockFile);
+        if (nFile >= nLastBlockFile)
+            return boost::shared_ptr<CMappedBlockFile>();
+    }
+
+    LOCK(cs_mappedfiles);
+    const boost::shared_ptr<CMappedBlockFile> *ppmapped = mapMappedBlockFiles.get(nFile);
+    if (ppmapped)
+        return pos.nPos < (*ppmapped)->nSize ? *ppmapped : boost::shared_ptr<CMappedBlockFile>();
+    FILE *file = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+    if (!file)
+        return boost::shared_ptr<CMappedBlockFile>();
+    size_t nSize;
+    const char *pbegin = MapFileReadOnly(file, nSize);
+    fclose(file);
+    if (!pbegin) {
+        LogPrintf("%s: mapping block file %d failed, reading it instead\n", __func__, nFile);
+        return boost::shared_ptr<CMappedBlockFile>();
+    }
+    boost::shared_ptr<CMappedBlockFile> pmapped(new CMappedBlockFile(pbegin, nSize));
+    mapMappedBlockFiles.insert(nFile, pmapped);
+    return pos.nPos < nSize ? pmapped : boost::shared_ptr<CMappedBlockFile>();
+}
+
+/**
+ * Block files, which are kept open, and recently read transactions and block hashes, so that
+ * reading the transactions of an address does not open and close a file for each of them.
+ */
+CCriticalSection cs_txread;
+lrumap<int, boost::shared_ptr<FILE> > mapTxReadFiles(MAX_TX_READ_FILES);
+lrumap<std::pair<int, unsigned int>, uint256> mapTxReadBlockHash(MAX_TX_READ_HASHES);
+lrumap<CDiskTxPos, std::pair<CTransaction, uint256> > mapTxReadCache(MAX_TX_READ_CACHE);
+
+} // anon namespace
+
+/** Read a transaction and the hash of its block, which is read from the block header, unless phashKnown is given */
+bool static ReadTransaction(CTransaction& tx, const CDiskTxPos &pos, uint256 &hashBlock, const uint256 *phashKnown) {
+    std::pair<int, unsigned int> blockpos(pos.nFile, pos.nPos);
+    bool fHashKnown = phashKnown != NULL;
+    uint256 hashKnown = phashKnown ? *phashKnown : uint256();
+    {
+        LOCK(cs_txread);
+        const std::pair<CTransaction, uint256> *pcached = mapTxReadCache.get(pos);
+        if (pcached) {
+            tx = pcached->first;
+            hashBlock = pcached->second;
+            return true;
+        }
+        if (!fHashKnown) {
+            const uint256 *phashBlock = mapTxReadBlockHash.get(blockpos);
+            if (phashBlock) {
+                fHashKnown = true;
+                hashKnown = *phashBlock;
+            }
+        }
+    }
+
+    // Mapped files are only read, so they are deserialized without holding cs_txread.
+    boost::shared_ptr<CMappedBlockFile> pmapped = GetMappedBlockFile(pos);
+    if (pmapped) {
+        try {
+            CMemoryReader reader(pmapped->pbegin + pos.nPos, pmapped->pbegin + pmapped->nSize, SER_DISK, CLIENT_VERSION);
+            if (fHashKnown) {
+                hashBlock = hashKnown;
+                reader.ignore(::GetSerializeSize(CBlockHeader(), SER_DISK, CLIENT_VERSION));
+            } else {
+                CBlockHeader header;
+                reader >> header;
+                hashBlock = header.GetHash();
+            }
+            reader.ignore(pos.nTxOffset);
+            reader >> tx;
+        } catch (std::exception &e) {
+            return error("%s : Deserialize error - %s", __func__, e.what());
+        }
+        LOCK(cs_txread);
+        if (!fHashKnown)
+            mapTxReadBlockHash.insert(blockpos, hashBlock);
+        mapTxReadCache.insert(pos, std::make_pair(tx, hashBlock), ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION));
+        return true;
+    }
+
+    // Open files are shared and positioned by each read, so cs_txread is held while reading them.
+    LOCK(cs_txread);
+    const boost::shared_ptr<FILE> *ppfile = mapTxReadFiles.get(pos.nFile);
+    boost::shared_ptr<FILE> pfile = ppfile ? *ppfile : boost::shared_ptr<FILE>();
+    if (!pfile) {
+        FILE *file = OpenBlockFile(CDiskBlockPos(pos.nFile, 0), true);
+        if (!file)
+            return error("%s: OpenBlockFile failed", __func__);
+        // Block files are preallocated, so data buffered from a file that is still written to
+        // may be stale zeros, which a later seek within the buffer would not drop. Such files
+        // are read unbuffered.
+        bool fGrowing;
+        {
+            LOCK(cs_LastBlockFile);
+            fGrowing = pos.nFile >= nLastBlockFile;
+        }
+        if (fGrowing && setvbuf(file, NULL, _IONBF, 0)) {
+            fclose(file);
+            return error("%s: setvbuf failed", __func__);
+        }
+        pfile.reset(file, ::fclose);
+        mapTxReadFiles.insert(pos.nFile, pfile);
+    }
+
+    // Earlier reads may have left the shared file anywhere, so every read seeks.
+    CAutoFile file(pfile.get(), SER_DISK, CLIENT_VERSION);
     try {
-        file >> header;
-        fseek(file.Get(), pos.nTxOffset, SEEK_CUR);
+        if (fHashKnown) {
+            hashBlock = hashKnown;
+            if (fseek(file.Get(), pos.nPos + ::GetSerializeSize(CBlockHeader(), SER_DISK, CLIENT_VERSION) + pos.nTxOffset, SEEK_SET))
+                throw std::ios_base::failure("fseek failed");
+        } else {
+            if (fseek(file.Get(), pos.nPos, SEEK_SET))
+                throw std::ios_base::failure("fseek failed");
+            CBlockHeader header;
+            file >> header;
+            hashBlock = header.GetHash();
+            if (fseek(file.Get(), pos.nTxOffset, SEEK_CUR))
+                throw std::ios_base::failure("fseek failed");
+        }
         file >> tx;
     } catch (std::exception &e) {
+        file.release();
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
-    hashBlock = header.GetHash();
+    file.release();
+
+    if (!fHashKnown)
+        mapTxReadBlockHash.insert(blockpos, hashBlock);
+    mapTxReadCache.insert(pos, std::make_pair(tx, hashBlock), ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION));
     return true;
 }
 
-bool FindTransactionsByDestination(const CTxDestination &dest, std::set<CExtDiskTxPos> &setpos) {
-    uint160 addrid = 0;
+bool ReadTransaction(CTransaction& tx, const CDiskTxPos &pos, uint256 &hashBlock) {
+    return ReadTransaction(tx, pos, hashBlock, NULL);
+}
+
+bool ReadTransaction(CTransaction& tx, const CDiskTxPos &pos, const CBlockIndex *pindex) {
+    uint256 hashBlock;
+    return ReadTransaction(tx, pos, hashBlock, pindex->phashBlock);
+}
+
+const CBlockIndex* CAddrIndexView::GetBlock(const CExtDiskTxPos &pos) const {
+    // The position of a block's data is set once it is stored, before the block can be connected
+    if (!pindexTip || pos.nHeight > (unsigned int)pindexTip->nHeight)
+        return NULL;
+    const CBlockIndex *pindex = pindexTip->GetAncestor(pos.nHeight);
+    if (pindex && pindex->nFile == pos.nFile && pindex->nDataPos == pos.nPos)
+        return pindex;
+    return NULL;
+}
+
+/** Convert a key or script destination into the id used by the address index */
+bool static GetAddrId(const CTxDestination &dest, uint160 &addrid) {
+    addrid = 0;
     const CKeyID *pkeyid = boost::get<CKeyID>(&dest);
     if (pkeyid)
         addrid = static_cast<uint160>(*pkeyid);
@@ -1134,16 +1342,152 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::set<CExtDisk
         if (pscriptid)
             addrid = static_cast<uint160>(*pscriptid);
     }
-    if (!addrid)
-        return false;
+    return addrid != 0;
+}
+
+/** Get the ids of the addresses, which can spend an output with the given script */
+void static ExtractAddrIds(const CScript &scriptPubKey, std::vector<uint160> &vAddrId) {
+    txnouttype type;
+    std::vector<CTxDestination> addresses;
+    int nRequired;
+    if (!ExtractDestinations(scriptPubKey, type, addresses, nRequired))
+        return;
+    BOOST_FOREACH(const CTxDestination &dest, addresses) {
+        uint160 addrid;
+        if (GetAddrId(dest, addrid))
+            vAddrId.push_back(addrid);
+    }
+}
+
+/** Get the address ids of vDest, without duplicates */
+bool static GetAddrIds(const std::vector<CTxDestination> &vDest, std::vector<uint160> &vAddrId) {
+    BOOST_FOREACH(const CTxDestination &dest, vDest) {
+        uint160 addrid;
+        if (!GetAddrId(dest, addrid))
+            return false;
+        vAddrId.push_back(addrid);
+    }
+    std::sort(vAddrId.begin(), vAddrId.end());
+    vAddrId.erase(std::unique(vAddrId.begin(), vAddrId.end()), vAddrId.end());
+    return true;
+}
+
+/** Buffer the address index changes of the block pindex, which follows pindexAddrIndexBest */
+void static AddAddrIndexPending(CAddrIndexUpdate &update, CBlockIndex *pindex) {
+    AssertLockHeld(cs_main);
+    if (vAddrIndexPending.empty())
+        pindexAddrIndexWritten = pindexAddrIndexBest;
+    boost::shared_ptr<CAddrIndexUpdate> pupdate(new CAddrIndexUpdate());
+    pupdate->swap(update);
+    pupdate->Sort();
+    nAddrIndexPendingCount += pupdate->GetCount();
+    vAddrIndexPending.push_back(pupdate);
+    pindexAddrIndexBest = pindex;
+}
 
+bool GetAddrIndexView(CAddrIndexView &view) {
     LOCK(cs_main);
+    if (!fAddrIndex || !pindexAddrIndexBest)
+        return false;
+    // The buffered changes are not written here, but read next to the snapshot, which
+    // is taken without writing anything, and so covers the blocks up to pindexWritten.
+    view.psnapshot.reset(paddrindex->NewSnapshot());
+    view.vPending = vAddrIndexPending;
+    view.pindexWritten = vAddrIndexPending.empty() ? pindexAddrIndexBest : pindexAddrIndexWritten;
+    view.pindexTip = pindexAddrIndexBest;
+    return true;
+}
+
+bool FindTransactionsByDestination(const CAddrIndexView &view, const CTxDestination &dest, std::vector<CExtDiskTxPos> &vpos,
+                                   int nMinHeight, int nMaxHeight, size_t nSkip, size_t nLimit, bool fReverse) {
+    return FindTransactionsByDestinations(view, std::vector<CTxDestination>(1, dest), vpos, nMinHeight, nMaxHeight, nSkip, nLimit, fReverse);
+}
+
+bool FindTransactionsByDestinations(const CAddrIndexView &view, const std::vector<CTxDestination> &vDest, std::vector<CExtDiskTxPos> &vpos,
+                                    int nMinHeight, int nMaxHeight, size_t nSkip, size_t nLimit, bool fReverse) {
+    std::vector<uint160> vAddrId;
+    if (!GetAddrIds(vDest, vAddrId))
+        return false;
+
+    if (!view.psnapshot)
+        return false;
+    std::vector<CExtDiskTxPos> vPending;
+    BOOST_FOREACH(const boost::shared_ptr<const CAddrIndexUpdate> &pupdate, view.vPending)
+        BOOST_FOREACH(const uint160 &addrid, vAddrId)
+            pupdate->GetAddrIndex(addrid, nMinHeight, nMaxHeight, vPending);
+    std::sort(vPending.begin(), vPending.end());
+    vPending.erase(std::unique(vPending.begin(), vPending.end()), vPending.end());
+    return paddrindex->ReadAddrIndex(vAddrId, vpos, nMinHeight, nMaxHeight, nSkip, nLimit, fReverse, view.psnapshot.get(), &vPending);
+}
+
+bool FindUnspentByDestination(const CAddrIndexView &view, const CTxDestination &dest, std::vector<std::pair<COutPoint, CAddrUnspent> > &vUnspent,
+                              int nMinHeight, const COutPoint *pafter, size_t nLimit) {
+    uint160 addrid;
+    if (!GetAddrId(dest, addrid))
+        return false;
+
+    if (!view.psnapshot)
+        return false;
+    CAddrUnspentChanges mapChanges;
+    BOOST_FOREACH(const boost::shared_ptr<const CAddrIndexUpdate> &pupdate, view.vPending)
+        pupdate->GetAddrUnspent(addrid, mapChanges);
+    return paddrindex->ReadAddrUnspentIndex(addrid, vUnspent, nMinHeight, pafter, nLimit, view.psnapshot.get(), &mapChanges);
+}
+
+static bool CompareMempoolEntryByTime(const CTxMemPoolEntry &a, const CTxMemPoolEntry &b)
+{
+    if (a.GetTime() != b.GetTime())
+        return a.GetTime() < b.GetTime();
+    return a.GetTx().GetHash() < b.GetTx().GetHash();
+}
+
+bool FindMempoolTransactionsByDestination(const CTxDestination &dest, std::vector<CTransaction> &vtx) {
+    return FindMempoolTransactionsByDestinations(std::vector<CTxDestination>(1, dest), vtx);
+}
+
+bool FindMempoolTransactionsByDestinations(const std::vector<CTxDestination> &vDest, std::vector<CTransaction> &vtx) {
+    std::vector<uint160> vAddrId;
+    if (!GetAddrIds(vDest, vAddrId))
+        return false;
     if (!fAddrIndex)
         return false;
-    std::vector<CExtDiskTxPos> vPos;
-    if (!pblocktree->ReadAddrIndex(addrid, vPos))
+
+    std::vector<CTxMemPoolEntry> vEntry;
+    {
+        LOCK(mempool.cs);
+        std::set<uint256> setSeen;
+        BOOST_FOREACH(const uint160 &addrid, vAddrId) {
+            std::vector<uint256> vtxid;
+            mempool.queryHashesByAddr(addrid, vtxid);
+            BOOST_FOREACH(const uint256 &txid, vtxid) {
+                if (!setSeen.insert(txid).second)
+                    continue;
+                std::map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.find(txid);
+                if (mi != mempool.mapTx.end())
+                    vEntry.push_back(mi->second);
+            }
+        }
+    }
+    std::sort(vEntry.begin(), vEntry.end(), CompareMempoolEntryByTime);
+    BOOST_FOREACH(const CTxMemPoolEntry &entry, vEntry)
+        vtx.push_back(entry.GetTx());
+    return true;
+}
+
+bool GetAddrSummary(const CAddrIndexView &view, const CTxDestination &dest, CAddrSummary &summary) {
+    uint160 addrid;
+    if (!GetAddrId(dest, addrid))
+        return false;
+
+    if (!view.psnapshot)
+        return false;
+    if (!paddrindex->ReadAddrSummary(addrid, summary, view.psnapshot.get()))
         return false;
-    setpos.insert(vPos.begin(), vPos.end());
+    BOOST_FOREACH(const boost::shared_ptr<const CAddrIndexUpdate> &pupdate, view.vPending) {
+        std::map<uint160, CAddrSummary>::const_iterator it = pupdate->mapSummary.find(addrid);
+        if (it != pupdate->mapSummary.end())
+            summary.Add(it->second);
+    }
     return true;
 }
 
@@ -1235,17 +1579,29 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    // Read block straight from memory, if its file is mapped
+    boost::shared_ptr<CMappedBlockFile> pmapped = GetMappedBlockFile(pos);
+    if (pmapped) {
+        try {
+            CMemoryReader reader(pmapped->pbegin + pos.nPos, pmapped->pbegin + pmapped->nSize, SER_DISK, CLIENT_VERSION);
+            reader >> block;
+        }
+        catch (std::exception &e) {
+            return error("%s : Deserialize error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk : OpenBlockFile failed");
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (std::exception &e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Check the header
@@ -1554,7 +1910,170 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+/**
+ * Index the key and script ids of standard scripts. With fAddrIndexPushes, also index every data
+ * push >= 8 bytes, or, if there is no such push, the entire script, as earlier versions did.
+ */
+void ExtractAddrIndexIds(const CScript &script, std::vector<uint160> &vAddrId) {
+    size_t nBegin = vAddrId.size();
+    ExtractAddrIds(script, vAddrId);
+    if (fAddrIndexPushes) {
+        CScript::const_iterator pc = script.begin();
+        CScript::const_iterator pend = script.end();
+        std::vector<unsigned char> data;
+        opcodetype opcode;
+        bool fHaveData = false;
+        while (pc < pend) {
+            script.GetOp(pc, opcode, data);
+            if (0 <= opcode && opcode <= OP_PUSHDATA4 && data.size() >= 8) { // data element
+                uint160 addrid = 0;
+                if (data.size() <= 20) {
+                    memcpy(&addrid, &data[0], data.size());
+                } else {
+                    addrid = Hash160(data);
+                }
+                vAddrId.push_back(addrid);
+                fHaveData = true;
+            }
+        }
+        if (!fHaveData) {
+            uint160 addrid = Hash160(script);
+            vAddrId.push_back(addrid);
+        }
+    }
+    // pushes of standard scripts are mostly their key and script ids
+    std::sort(vAddrId.begin() + nBegin, vAddrId.end());
+    vAddrId.erase(std::unique(vAddrId.begin() + nBegin, vAddrId.end()), vAddrId.end());
+}
+
+void static BuildAddrIndex(const CScript &script, const CExtDiskTxPos &pos, std::vector<std::pair<uint160, CExtDiskTxPos> > &out) {
+    std::vector<uint160> vAddrId;
+    ExtractAddrIndexIds(script, vAddrId);
+    BOOST_FOREACH(const uint160 &addrid, vAddrId)
+        out.push_back(std::make_pair(addrid, pos));
+}
+
+/** Collect the address index entries of a block, taking the scripts of spent outputs from its undo data */
+void static BuildAddrIndexForBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, std::vector<std::pair<uint160, CExtDiskTxPos> > &out) {
+    CExtDiskTxPos pos(CDiskTxPos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size())), pindex->nHeight);
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        if (i > 0) {
+            BOOST_FOREACH(const CTxInUndo &undo, blockundo.vtxundo[i-1].vprevout)
+                BuildAddrIndex(undo.txout.scriptPubKey, pos, out);
+        }
+        BOOST_FOREACH(const CTxOut &txout, tx.vout)
+            BuildAddrIndex(txout.scriptPubKey, pos, out);
+        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+    }
+}
+
+/** Get the ids of the addresses, which can spend an output with the given script on their own */
+void static ExtractSingleAddrIds(const CScript &scriptPubKey, std::vector<uint160> &vAddrId) {
+    txnouttype type;
+    std::vector<CTxDestination> addresses;
+    int nRequired;
+    if (!ExtractDestinations(scriptPubKey, type, addresses, nRequired) || nRequired != 1)
+        return;
+    BOOST_FOREACH(const CTxDestination &dest, addresses) {
+        uint160 addrid;
+        if (GetAddrId(dest, addrid))
+            vAddrId.push_back(addrid);
+    }
+}
+
+/**
+ * Collect the changes of a block to the address summaries: every transaction in the address
+ * index entries vPosAddrid counts once per address, and values are taken from the outputs of
+ * the block and the spent outputs in its undo data.
+ */
+void static BuildAddrSummaryForBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex,
+                                     const std::vector<std::pair<uint160, CExtDiskTxPos> > &vPosAddrid,
+                                     std::map<uint160, CAddrSummary> &mapSummary) {
+    std::set<std::pair<uint160, CExtDiskTxPos> > setSeen;
+    for (std::vector<std::pair<uint160, CExtDiskTxPos> >::const_iterator it = vPosAddrid.begin(); it != vPosAddrid.end(); ++it) {
+        if (!setSeen.insert(*it).second)
+            continue;
+        CAddrSummary &summary = mapSummary[it->first];
+        if (summary.nTxCount == 0)
+            summary.nFirstHeight = pindex->nHeight;
+        summary.nLastHeight = pindex->nHeight;
+        summary.nTxCount++;
+    }
+    std::vector<uint160> vAddrId;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        if (i > 0) {
+            BOOST_FOREACH(const CTxInUndo &undo, blockundo.vtxundo[i-1].vprevout) {
+                vAddrId.clear();
+                ExtractSingleAddrIds(undo.txout.scriptPubKey, vAddrId);
+                BOOST_FOREACH(const uint160 &addrid, vAddrId)
+                    mapSummary[addrid].nSent += undo.txout.nValue;
+            }
+        }
+        BOOST_FOREACH(const CTxOut &txout, tx.vout) {
+            vAddrId.clear();
+            ExtractSingleAddrIds(txout.scriptPubKey, vAddrId);
+            BOOST_FOREACH(const uint160 &addrid, vAddrId)
+                mapSummary[addrid].nReceived += txout.nValue;
+        }
+    }
+}
+
+/**
+ * Collect the changes of a block to the address index of unspent outputs from its undo data: its
+ * outputs are added and the spent ones removed, or the other way round, if fRevert is set. The
+ * heights of restored outputs, which the undo data only has for the last output of a transaction,
+ * are taken from view.
+ */
+void static BuildAddrUnspentForBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fRevert,
+                                     const CCoinsViewCache &view, CAddrIndexUpdate &update) {
+    std::vector<uint160> vAddrId;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        if (i > 0) {
+            const CTxUndo &txundo = blockundo.vtxundo[i-1];
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const COutPoint &out = tx.vin[j].prevout;
+                const CTxInUndo &undo = txundo.vprevout[j];
+                vAddrId.clear();
+                ExtractAddrIds(undo.txout.scriptPubKey, vAddrId);
+                BOOST_FOREACH(const uint160 &addrid, vAddrId) {
+                    if (!fRevert) {
+                        update.vUnspentErase.push_back(std::make_pair(addrid, out));
+                    } else {
+                        int nHeight = undo.nHeight;
+                        if (nHeight == 0) {
+                            const CCoins *coins = view.AccessCoins(out.hash);
+                            nHeight = coins ? coins->nHeight : 0;
+                        }
+                        update.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, out), CAddrUnspent(undo.txout, nHeight)));
+                    }
+                }
+            }
+        }
+        for (unsigned int n = 0; n < tx.vout.size(); n++) {
+            vAddrId.clear();
+            ExtractAddrIds(tx.vout[n].scriptPubKey, vAddrId);
+            BOOST_FOREACH(const uint160 &addrid, vAddrId) {
+                if (!fRevert)
+                    update.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, COutPoint(tx.GetHash(), n)), CAddrUnspent(tx.vout[n], pindex->nHeight)));
+                else
+                    update.vUnspentErase.push_back(std::make_pair(addrid, COutPoint(tx.GetHash(), n)));
+            }
+        }
+    }
+}
+
+void BuildAddrIndexUpdate(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fRevert,
+                          const CCoinsViewCache &view, CAddrIndexUpdate &update) {
+    update.vPosAddrid.reserve(4 * block.vtx.size());
+    BuildAddrIndexForBlock(block, blockundo, pindex, update.vPosAddrid);
+    BuildAddrSummaryForBlock(block, blockundo, pindex, update.vPosAddrid, update.mapSummary);
+    BuildAddrUnspentForBlock(block, blockundo, pindex, fRevert, view, update);
+}
+
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, bool fJustCheck)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1630,6 +2149,24 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         }
     }
 
+    // undo the changes of the block to the address index, if it covers the block,
+    // so that the index only refers to transactions of the active chain
+    // (reverting reads the summaries from the database, so the buffered changes are written first).
+    // The index is a database of its own, so this cannot share a batch with the chainstate. It is
+    // written in one batch with the block it then covers instead, and may be found ahead of or
+    // behind the chainstate after a crash (FlushStateToDisk also writes it before the coins).
+    // InitAddrIndex then undoes the blocks after the fork with the active chain, and the
+    // background sync connects the missing ones again.
+    if (fAddrIndex && fClean && !fJustCheck && pindex == pindexAddrIndexBest) {
+        if (!FlushAddrIndex(state))
+            return false;
+        CAddrIndexUpdate update;
+        BuildAddrIndexUpdate(block, blockUndo, pindex, true, view, update);
+        if (!paddrindex->WriteAddrIndex(update, pindex->pprev->GetBlockHash(), true))
+            return state.Abort(_("Failed to write address index"));
+        pindexAddrIndexBest = pindex->pprev;
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -1673,29 +2210,83 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
-// Index either: a) every data push >= 8 bytes,  b) if no such pushes, the entire script
-void static BuildAddrIndex(const CScript &script, const CExtDiskTxPos &pos, std::vector<std::pair<uint160, CExtDiskTxPos> > &out) {
-    CScript::const_iterator pc = script.begin();
-    CScript::const_iterator pend = script.end();
-    std::vector<unsigned char> data;
-    opcodetype opcode;
-    bool fHaveData = false;
-    while (pc < pend) {
-        script.GetOp(pc, opcode, data);
-        if (0 <= opcode && opcode <= OP_PUSHDATA4 && data.size() >= 8) { // data element
-            uint160 addrid = 0;
-            if (data.size() <= 20) {
-                memcpy(&addrid, &data[0], data.size());
-            } else {
-                addrid = Hash160(data);
-            }
-            out.push_back(std::make_pair(addrid, pos));
-            fHaveData = true;
+/** Read of the coins of one transaction from a view, which allows concurrent reads */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView *pview;
+    uint256 txid;
+    CCoins *pcoins;
+    char *pfFound;
+
+public:
+    CCoinsPrefetch() : pview(NULL), pcoins(NULL), pfFound(NULL) {}
+    CCoinsPrefetch(const CCoinsView *pviewIn, const uint256 &txidIn, CCoins *pcoinsIn, char *pfFoundIn) :
+        pview(pviewIn), txid(txidIn), pcoins(pcoinsIn), pfFound(pfFoundIn) {}
+
+    bool operator()() {
+        *pfFound = pview->GetCoins(txid, *pcoins);
+        return true;
+    }
+
+    void swap(CCoinsPrefetch &check) {
+        std::swap(pview, check.pview);
+        std::swap(txid, check.txid);
+        std::swap(pcoins, check.pcoins);
+        std::swap(pfFound, check.pfFound);
+    }
+};
+
+/**
+ * Queue of the prefetch threads, of which there are as many as script check threads. It is
+ * separate from the script check queue, which takes another type of job, but both are never
+ * busy at once: the prefetch is done, before the scripts of the block are checked.
+ */
+static CCheckQueue<CCoinsPrefetch> prefetchqueue(16);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    prefetchqueue.Thread();
+}
+
+/**
+ * Read the coins spent by a block, which are not in the coins cache yet, from the coins
+ * database on the prefetch threads at once, rather than one at a time while the block
+ * is connected. Coins created within the block are not looked up.
+ */
+void static PrefetchInputs(const CBlock &block, CCoinsViewCache &cache)
+{
+    if (!nScriptCheckThreads)
+        return;
+    std::set<uint256> setSkip;
+    BOOST_FOREACH(const CTransaction &tx, block.vtx)
+        setSkip.insert(tx.GetHash());
+    std::vector<uint256> vTxid;
+    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+            if (setSkip.insert(txin.prevout.hash).second && !cache.HaveCoinsInCache(txin.prevout.hash))
+                vTxid.push_back(txin.prevout.hash);
         }
     }
-    if (!fHaveData) {
-        uint160 addrid = Hash160(script);
-        out.push_back(std::make_pair(addrid, pos));
+    if (vTxid.size() < 2)
+        return;
+
+    std::vector<CCoins> vCoins(vTxid.size());
+    std::vector<char> vFound(vTxid.size(), 0);
+    {
+        CCheckQueueControl<CCoinsPrefetch> control(&prefetchqueue);
+        std::vector<CCoinsPrefetch> vChecks;
+        vChecks.reserve(vTxid.size());
+        for (size_t i = 0; i < vTxid.size(); i++)
+            vChecks.push_back(CCoinsPrefetch(cache.GetBackend(), vTxid[i], &vCoins[i], &vFound[i]));
+        control.Add(vChecks);
+        control.Wait();
+    }
+    for (size_t i = 0; i < vTxid.size(); i++) {
+        if (vFound[i])
+            cache.AddFetchedCoins(vTxid[i], vCoins[i]);
     }
 }
 
@@ -1719,6 +2310,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == Params().HashGenesisBlock()) {
+        // the address index of a new block database starts here
+        if (fAddrIndex && !fJustCheck && pindexAddrIndexBest == NULL) {
+            CAddrIndexUpdate addrIndexUpdate;
+            AddAddrIndexPending(addrIndexUpdate, pindex);
+        }
         view.SetBestBlock(pindex->GetBlockHash());
         return true;
     }
@@ -1770,11 +2366,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     unsigned int nSigOps = 0;
     CExtDiskTxPos pos(CDiskTxPos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size())), pindex->nHeight);
     std::vector<std::pair<uint256, CDiskTxPos> > vPosTxid;
-    std::vector<std::pair<uint160, CExtDiskTxPos> > vPosAddrid;
     if (fTxIndex)
         vPosTxid.reserve(block.vtx.size());
-    if (fAddrIndex)
-        vPosAddrid.reserve(4 * block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -1813,18 +2406,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
         if (fTxIndex)
             vPosTxid.push_back(std::make_pair(tx.GetHash(), pos));
-        if (fAddrIndex) {
-            if (!tx.IsCoinBase()) {
-                BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-                    CCoins coins;
-                    view.GetCoins(txin.prevout.hash, coins);
-                    BuildAddrIndex(coins.vout[txin.prevout.n].scriptPubKey, pos, vPosAddrid);
-                }
-            }
-            BOOST_FOREACH(const CTxOut &txout, tx.vout)
-            BuildAddrIndex(txout.scriptPubKey, pos, vPosAddrid);
-        }
-
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -1872,9 +2453,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (fTxIndex)
         if (!pblocktree->WriteTxIndex(vPosTxid))
             return state.Abort("Failed to write transaction index");
-    if (fAddrIndex)
-        if (!pblocktree->AddAddrIndex(vPosAddrid))
-            return state.Abort(_("Failed to write address index"));
+    // the address index is only kept up to date here, once it has caught up with the active
+    // chain, and the spent outputs are taken from the undo data of the block. Its changes are
+    // buffered, and written by FlushStateToDisk, with the chainstate or once there are many of them.
+    if (fAddrIndex && pindex->pprev == pindexAddrIndexBest) {
+        CAddrIndexUpdate addrIndexUpdate;
+        BuildAddrIndexUpdate(block, blockundo, pindex, false, view, addrIndexUpdate);
+        AddAddrIndexPending(addrIndexUpdate, pindex);
+    }
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -1893,6 +2479,77 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     return true;
 }
 
+/** Order address index entries like their keys in the database */
+/**
+ * Write all block and undo data, and then the block file information and block index, which may refer to them.
+ * Unless fSync is set, nothing is synced to disk, which leaves the writes to survive a crash of the process only.
+ */
+bool static FlushBlockIndex(CValidationState &state, bool fSync = true) {
+    AssertLockHeld(cs_main);
+    if (fSync)
+        FlushBlockFile();
+    bool fileschanged = false;
+    for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
+        if (!pblocktree->WriteBlockFileInfo(*it, vinfoBlockFile[*it])) {
+            return state.Abort("Failed to write to block index");
+        }
+        fileschanged = true;
+        setDirtyFileInfo.erase(it++);
+    }
+    if (fileschanged && !pblocktree->WriteLastBlockFile(nLastBlockFile)) {
+        return state.Abort("Failed to write to block index");
+    }
+    for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
+         if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
+             return state.Abort("Failed to write to block index");
+         }
+         setDirtyBlockIndex.erase(it++);
+    }
+    if (fSync)
+        pblocktree->Sync();
+    return true;
+}
+
+/**
+ * Write the buffered address index changes, together with pindexAddrIndexBest as the last
+ * block they cover. The block index must have been written before, so that the block is
+ * known when the index is loaded again; after a crash, the index then resumes from there.
+ */
+bool static WriteAddrIndexPending(CValidationState &state) {
+    AssertLockHeld(cs_main);
+    if (vAddrIndexPending.empty())
+        return true;
+    CAddrIndexUpdate update;
+    BOOST_FOREACH(const boost::shared_ptr<const CAddrIndexUpdate> &pupdate, vAddrIndexPending)
+        update.Add(*pupdate);
+    update.Sort();
+    if (!paddrindex->WriteAddrIndex(update, pindexAddrIndexBest->GetBlockHash()))
+        return state.Abort(_("Failed to write address index"));
+    vAddrIndexPending.clear();
+    nAddrIndexPendingCount = 0;
+    return true;
+}
+
+/**
+ * Write the buffered address index changes, outside of a chainstate flush, so that they can be
+ * read or reverted. Nothing is synced, which is left to FlushStateToDisk: after a crash of the
+ * system, the index may be found behind the tip, or covering an unknown block, and is rebuilt.
+ */
+bool static FlushAddrIndex(CValidationState &state) {
+    LOCK(cs_main);
+    if (vAddrIndexPending.empty())
+        return true;
+    try {
+        return FlushBlockIndex(state, false) && WriteAddrIndexPending(state);
+    } catch (const std::runtime_error& e) {
+        return state.Abort(std::string("System error while flushing: ") + e.what());
+    }
+}
+
+static void NotifyBestChain(const CBlockLocator &locator) {
+    g_signals.SetBestChain(locator);
+}
+
 enum FlushStateMode {
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
@@ -1908,8 +2565,15 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
+    // The coins cache is flushed once the memory it takes exceeds its share of -dbcache.
+    size_t cacheUsage = pcoinsTip->DynamicMemoryUsage();
+    // Coins, which are still written in the background, count against that share: a cache,
+    // which does not fit next to them, waits for their write, before it grows any further.
+    if (pcoinswriter && mode != FLUSH_STATE_ALWAYS && cacheUsage <= nCoinCacheUsage &&
+        cacheUsage + pcoinswriter->DynamicMemoryUsage() > nCoinCacheUsage && !pcoinswriter->Sync())
+        return state.Abort("Failed to write to coin database");
     if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && cacheUsage > nCoinCacheUsage) ||
         (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
@@ -1918,35 +2582,28 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // overwrite one. Still, use a conservative safety factor of 2.
         if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
-        // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
-        // Then update all block file information (which may refer to block and undo files).
-        bool fileschanged = false;
-        for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
-            if (!pblocktree->WriteBlockFileInfo(*it, vinfoBlockFile[*it])) {
-                return state.Abort("Failed to write to block index");
-            }
-            fileschanged = true;
-            setDirtyFileInfo.erase(it++);
-        }
-        if (fileschanged && !pblocktree->WriteLastBlockFile(nLastBlockFile)) {
-            return state.Abort("Failed to write to block index");
-        }
-        for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-             if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
-                 return state.Abort("Failed to write to block index");
-             }
-             setDirtyBlockIndex.erase(it++);
-        }
-        pblocktree->Sync();
+        // First make sure all block and undo data, and the block index, is flushed to disk.
+        if (!FlushBlockIndex(state))
+            return false;
+        // Then write the buffered address index changes (which may refer to block index entries).
+        if (!WriteAddrIndexPending(state))
+            return false;
         // Finally flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return state.Abort("Failed to write to coin database");
-        // Update best block in wallet (so we can detect restored wallets).
+        // Update best block in wallet (so we can detect restored wallets), once the coins
+        // of it are written.
         if (mode != FLUSH_STATE_IF_NEEDED) {
-            g_signals.SetBestChain(chainActive.GetLocator());
+            if (pcoinswriter)
+                pcoinswriter->CallWhenWritten(boost::bind(&NotifyBestChain, chainActive.GetLocator()));
+            else
+                g_signals.SetBestChain(chainActive.GetLocator());
         }
         nLastWrite = GetTimeMicros();
+    } else if (nAddrIndexPendingCount > MAX_ADDRINDEX_PENDING) {
+        // Too many address index changes to buffer until the next chainstate flush are written on their own.
+        if (!FlushBlockIndex(state, false) || !WriteAddrIndexPending(state))
+            return false;
     }
     } catch (const std::runtime_error& e) {
         return state.Abort(std::string("System error while flushing: ") + e.what());
@@ -1967,10 +2624,10 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-      Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+      Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2040,6 +2697,7 @@ bool static DisconnectTip(CValidationState &state) {
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2064,6 +2722,9 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchInputs(*pblock, *pcoinsTip);
+    int64_t nTime2b = GetTimeMicros(); nTimePrefetch += nTime2b - nTime2;
+    LogPrint("bench", "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTime2b - nTime2) * 0.001, nTimePrefetch * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
@@ -2075,8 +2736,8 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
             return error("ConnectTip() : ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(inv.hash);
-        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
-        LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
+        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2b;
+        LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2b) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
@@ -3036,6 +3697,19 @@ bool static LoadBlockIndexDB()
     // Check whether we have an address index
     pblocktree->ReadFlag("addrindex", fAddrIndex);
     LogPrintf("LoadBlockIndexDB(): address index %s\n", fAddrIndex ? "enabled" : "disabled");
+    // Earlier versions indexed data pushes, and did not record it
+    fAddrIndexPushes = true;
+    pblocktree->ReadFlag("addrindexpushes", fAddrIndexPushes);
+    if (fAddrIndex)
+        LogPrintf("LoadBlockIndexDB(): address index of data pushes %s\n", fAddrIndexPushes ? "enabled" : "disabled");
+    if (fAddrIndex && paddrindex && !pblocktree->MoveAddrIndex(*paddrindex))
+        return error("LoadBlockIndexDB() : failed to move address index");
+    uint256 hashAddrIndexBest;
+    if (fAddrIndex && paddrindex && paddrindex->ReadAddrIndexBest(hashAddrIndexBest)) {
+        BlockMap::iterator it = mapBlockIndex.find(hashAddrIndexBest);
+        if (it != mapBlockIndex.end())
+            pindexAddrIndexBest = it->second;
+    }
 
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
@@ -3104,9 +3778,9 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
+            if (!DisconnectBlock(block, state, pindex, coins, &fClean, true))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             pindexState = pindex->pprev;
             if (!fClean) {
@@ -3141,12 +3815,261 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
     return true;
 }
 
+/** Changes of a block of the active chain to the address index */
+struct CAddrIndexBlock
+{
+    int nHeight;
+    bool fOk;
+    CAddrIndexUpdate update;
+
+    CAddrIndexBlock() : nHeight(0), fOk(false) {}
+
+    void swap(CAddrIndexBlock &other) {
+        std::swap(nHeight, other.nHeight);
+        std::swap(fOk, other.fOk);
+        update.vPosAddrid.swap(other.update.vPosAddrid);
+        update.vUnspentAdd.swap(other.update.vUnspentAdd);
+        update.vUnspentErase.swap(other.update.vUnspentErase);
+        update.mapSummary.swap(other.update.mapSummary);
+    }
+};
+
+/** Read a block and its undo data from disk */
+bool static ReadBlockAndUndo(const CBlockIndex *pindex, CBlock &block, CBlockUndo &blockundo)
+{
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s : *** ReadBlockFromDisk failed at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull() || !blockundo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
+        return error("%s : *** failure reading undo data at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s : *** block and undo data inconsistent at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    return true;
+}
+
+/** Read a block and its undo data from disk, and collect its changes to the address index, without verifying it */
+void static ReadAddrIndexBlock(const CBlockIndex *pindex, CAddrIndexBlock &result)
+{
+    result.nHeight = pindex->nHeight;
+    CBlock block;
+    CBlockUndo blockundo;
+    result.fOk = ReadBlockAndUndo(pindex, block, blockundo);
+    if (result.fOk) {
+        // outputs are only removed when connecting, so no coins are needed
+        CCoinsView viewDummy;
+        CCoinsViewCache view(&viewDummy);
+        BuildAddrIndexUpdate(block, blockundo, pindex, false, view, result.update);
+    }
+}
+
+/**
+ * Reads the blocks of a chain on several threads, at most nMaxAhead blocks ahead of the
+ * consumer, and hands out their changes to the address index in the order of the chain.
+ */
+class CAddrIndexReader
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    boost::thread_group threads;
+    const std::vector<CBlockIndex*> &vChain;
+    size_t nMaxAhead;
+    size_t nNext;       //! position in vChain of the next block to read
+    size_t nConsumed;   //! number of blocks handed out
+    bool fStop;
+    std::map<size_t, CAddrIndexBlock> mapRead;
+
+    void ThreadRead() {
+        RenameThread("bitcoin-addrread");
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNext < vChain.size() && nNext >= nConsumed + nMaxAhead)
+                    cond.wait(lock);
+                if (fStop || nNext >= vChain.size())
+                    return;
+                i = nNext++;
+            }
+            CAddrIndexBlock result;
+            ReadAddrIndexBlock(vChain[i], result);
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                mapRead[i].swap(result);
+            }
+            cond.notify_all();
+        }
+    }
+
+public:
+    CAddrIndexReader(const std::vector<CBlockIndex*> &vChainIn, int nThreads, size_t nMaxAheadIn) :
+        vChain(vChainIn), nMaxAhead(nMaxAheadIn), nNext(0), nConsumed(0), fStop(false) {
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CAddrIndexReader::ThreadRead, this));
+    }
+
+    ~CAddrIndexReader() {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        cond.notify_all();
+        threads.join_all();
+    }
+
+    //! Wait for the next block of the chain, and return false, if there is none
+    bool Next(CAddrIndexBlock &result) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nConsumed >= vChain.size())
+                return false;
+            std::map<size_t, CAddrIndexBlock>::iterator it;
+            while ((it = mapRead.find(nConsumed)) == mapRead.end())
+                cond.wait(lock);
+            result.swap(it->second);
+            mapRead.erase(it);
+            nConsumed++;
+        }
+        cond.notify_all();
+        return true;
+    }
+};
+
+/** Start the address index over with the genesis block of the active chain, if there is one */
+bool static ResetAddrIndex()
+{
+    pindexAddrIndexBest = NULL;
+    vAddrIndexPending.clear();
+    nAddrIndexPendingCount = 0;
+    if (!paddrindex->WipeAddrIndex() || !pblocktree->EraseLegacyAddrIndex())
+        return false;
+    if (chainActive.Genesis() != NULL) {
+        if (!paddrindex->WriteAddrIndex(CAddrIndexUpdate(), chainActive.Genesis()->GetBlockHash()))
+            return false;
+        pindexAddrIndexBest = chainActive.Genesis();
+    }
+    return true;
+}
+
+bool EnableAddrIndex(bool fPushes)
+{
+    LOCK(cs_main);
+    if (!ResetAddrIndex() || !pblocktree->WriteFlag("addrindexpushes", fPushes) || !pblocktree->WriteFlag("addrindex", true))
+        return false;
+    fAddrIndex = true;
+    fAddrIndexPushes = fPushes;
+    return true;
+}
+
+bool InitAddrIndex()
+{
+    LOCK(cs_main);
+    if (!fAddrIndex)
+        return true;
+
+    // The script solver sets up its templates on first use, which must not happen
+    // on several threads at once.
+    {
+        txnouttype type;
+        std::vector<std::vector<unsigned char> > vSolutions;
+        Solver(CScript(), type, vSolutions);
+    }
+
+    // Earlier versions, which did not record the last block covered by the index, kept
+    // it in the block database, from which it was erased by MoveAddrIndex.
+    if (pindexAddrIndexBest == NULL && chainActive.Genesis() != NULL) {
+        LogPrintf("Rebuilding address index...\n");
+        if (!ResetAddrIndex())
+            return error("InitAddrIndex() : failed to erase address index");
+    }
+
+    // Undo the blocks, which were disconnected while the index was behind, or were
+    // not written to the chainstate before a crash.
+    if (pindexAddrIndexBest != NULL && !chainActive.Contains(pindexAddrIndexBest)) {
+        const CBlockIndex *pindexFork = chainActive.FindFork(pindexAddrIndexBest);
+        LogPrintf("Rewinding address index from height %d to %d...\n", pindexAddrIndexBest->nHeight, pindexFork->nHeight);
+        while (pindexAddrIndexBest != pindexFork) {
+            boost::this_thread::interruption_point();
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!ReadBlockAndUndo(pindexAddrIndexBest, block, blockundo))
+                return false;
+            CAddrIndexUpdate update;
+            BuildAddrIndexUpdate(block, blockundo, pindexAddrIndexBest, true, *pcoinsTip, update);
+            if (!paddrindex->WriteAddrIndex(update, pindexAddrIndexBest->pprev->GetBlockHash(), true))
+                return error("InitAddrIndex() : failed to write address index");
+            pindexAddrIndexBest = pindexAddrIndexBest->pprev;
+        }
+    }
+
+    return true;
+}
+
+void ThreadAddrIndexSync()
+{
+    RenameThread("bitcoin-addrindex");
+    int nThreads = std::max(nScriptCheckThreads, 1);
+
+    while (true) {
+        std::vector<CBlockIndex*> vChain;
+        {
+            LOCK(cs_main);
+            // a new index starts with the genesis block, and is kept up to date from there
+            if (pindexAddrIndexBest == NULL)
+                return;
+            if (!chainActive.Contains(pindexAddrIndexBest)) {
+                LogPrintf("%s: address index is not on the active chain\n", __func__);
+                return;
+            }
+            for (CBlockIndex *pindex = chainActive.Next(pindexAddrIndexBest); pindex; pindex = chainActive.Next(pindex))
+                vChain.push_back(pindex);
+            if (vChain.empty()) {
+                LogPrintf("%s: address index is up to date at height %d\n", __func__, pindexAddrIndexBest->nHeight);
+                return;
+            }
+            LogPrintf("%s: syncing address index from height %d to %d\n", __func__, pindexAddrIndexBest->nHeight, chainActive.Height());
+        }
+
+        // Blocks are read without holding cs_main, and their changes are written in groups,
+        // as long as they continue the index on the active chain.
+        CAddrIndexReader reader(vChain, nThreads, 8 * nThreads);
+        CAddrIndexBlock block;
+        CAddrIndexUpdate update;
+        size_t nFirst = 0;
+        for (size_t i = 0; i < vChain.size(); i++) {
+            boost::this_thread::interruption_point();
+            if (!reader.Next(block) || !block.fOk) {
+                LogPrintf("%s: failed to read block at height %d\n", __func__, vChain[i]->nHeight);
+                return;
+            }
+            update.Add(block.update);
+            if (i + 1 < vChain.size() && update.vPosAddrid.size() < 100000 && update.mapSummary.size() < 100000)
+                continue;
+
+            {
+                LOCK(cs_main);
+                if (vChain[nFirst]->pprev != pindexAddrIndexBest || !chainActive.Contains(vChain[i]))
+                    break;
+                AddAddrIndexPending(update, vChain[i]);
+                CValidationState state;
+                if (!FlushAddrIndex(state))
+                    return;
+            }
+            update = CAddrIndexUpdate();
+            nFirst = i + 1;
+        }
+    }
+}
+
 void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
+    pindexAddrIndexBest = NULL;
+    vAddrIndexPending.clear();
+    nAddrIndexPendingCount = 0;
 }
 
 bool LoadBlockIndex()
@@ -3169,6 +4092,8 @@ bool InitBlockIndex() {
     pblocktree->WriteFlag("txindex", fTxIndex);
     fAddrIndex = GetBoolArg("-addrindex", false);
     pblocktree->WriteFlag("addrindex", fAddrIndex);
+    fAddrIndexPushes = GetBoolArg("-addrindexpushes", false);
+    pblocktree->WriteFlag("addrindexpushes", fAddrIndexPushes);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -29,6 +29,7 @@
 
 #include <algorithm>
 #include <exception>
+#include <limits>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -36,12 +37,19 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
+class CAddrIndexDB;
+struct CAddrIndexUpdate;
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
+class CCoinsViewCompact;
+class CCoinsViewDB;
+class CCoinsViewDBWriter;
 class CInv;
+class CLevelDBSnapshot;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -78,6 +86,10 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -backgroundflush default */
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
+/** -compactcoincache default */
+static const bool DEFAULT_COMPACT_COIN_CACHE = false;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -92,6 +104,8 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
+/** Number of buffered address index entries, above which FlushStateToDisk writes them without the chainstate. */
+static const unsigned int MAX_ADDRINDEX_PENDING = 250000;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 
@@ -126,13 +140,17 @@ extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fAddrIndex;
+extern bool fAddrIndexPushes;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern bool fMapBlockFiles;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
+/** Last block of the active chain covered by the address index, which catches up in the background. */
+extern CBlockIndex *pindexAddrIndexBest;
 
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
@@ -190,6 +208,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread reading the coins spent by a block ahead of its connection */
+void ThreadCoinsPrefetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core */
@@ -303,6 +323,92 @@ struct CExtDiskTxPos : public CDiskTxPos
 };
 
 
+/** Unspent transaction output, as stored in the address index of unspent outputs */
+struct CAddrUnspent
+{
+    CTxOut txout;
+    int nHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(nHeight));
+        READWRITE(REF(CTxOutCompressor(REF(txout))));
+    }
+
+    CAddrUnspent(const CTxOut &txoutIn, int nHeightIn) : txout(txoutIn), nHeight(nHeightIn) {
+    }
+
+    CAddrUnspent() : nHeight(0) {
+    }
+};
+
+/**
+ * Summary of the transactions of an address, as stored in the address index. Values
+ * count the outputs, which the address can spend on its own.
+ */
+struct CAddrSummary
+{
+    CAmount nReceived;
+    CAmount nSent;
+    unsigned int nTxCount;  //! number of transactions in the address index
+    int nFirstHeight;       //! height of the first of them
+    int nLastHeight;        //! height of the last of them
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(nReceived));
+        READWRITE(VARINT(nSent));
+        READWRITE(VARINT(nTxCount));
+        READWRITE(VARINT(nFirstHeight));
+        READWRITE(VARINT(nLastHeight));
+    }
+
+    CAddrSummary() : nReceived(0), nSent(0), nTxCount(0), nFirstHeight(0), nLastHeight(0) {
+    }
+
+    CAmount GetBalance() const {
+        return nReceived - nSent;
+    }
+
+    //! Add the changes of later transactions
+    void Add(const CAddrSummary &change) {
+        if (nTxCount == 0)
+            nFirstHeight = change.nFirstHeight;
+        nLastHeight = change.nLastHeight;
+        nTxCount += change.nTxCount;
+        nReceived += change.nReceived;
+        nSent += change.nSent;
+    }
+};
+
+/**
+ * Consistent view of the address index, and of the chain it covers, so that queries can read
+ * the index and resolve its entries to blocks without holding cs_main. Block index entries
+ * are never freed while running, and the blocks of the view are reached from pindexTip.
+ * The snapshot covers the blocks up to pindexWritten, and the changes of the following
+ * blocks, which are not written yet, are read from vPending.
+ */
+class CAddrIndexView
+{
+public:
+    boost::shared_ptr<CLevelDBSnapshot> psnapshot;
+    std::vector<boost::shared_ptr<const CAddrIndexUpdate> > vPending;
+    const CBlockIndex *pindexWritten;
+    const CBlockIndex *pindexTip;
+
+    CAddrIndexView() : pindexWritten(NULL), pindexTip(NULL) {}
+
+    int Height() const { return pindexTip ? pindexTip->nHeight : -1; }
+
+    /** Get the block of the viewed chain, which holds the indexed transaction at pos, or NULL if it is orphaned */
+    const CBlockIndex* GetBlock(const CExtDiskTxPos &pos) const;
+};
+
+
 CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree);
 
 /**
@@ -418,9 +524,37 @@ public:
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadTransaction(CTransaction& tx, const CDiskTxPos &pos, uint256 &hashBlock);
+/** Read a transaction of the block pindex, whose hash is known, without reading the block header */
+bool ReadTransaction(CTransaction& tx, const CDiskTxPos &pos, const CBlockIndex *pindex);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
-bool FindTransactionsByDestination(const CTxDestination &dest, std::set<CExtDiskTxPos> &setpos);
+/** Take a view of the address index at the last block it covers, or return false if it is disabled */
+bool GetAddrIndexView(CAddrIndexView &view);
+/** Find the positions of transactions associated with dest, see CBlockTreeDB::ReadAddrIndex for the selection */
+bool FindTransactionsByDestination(const CAddrIndexView &view, const CTxDestination &dest, std::vector<CExtDiskTxPos> &vpos,
+                                   int nMinHeight = 0, int nMaxHeight = std::numeric_limits<int>::max(),
+                                   size_t nSkip = 0, size_t nLimit = std::numeric_limits<size_t>::max(), bool fReverse = false);
+/** Find the positions of transactions associated with any of vDest, merged in the order of the block chain without duplicates */
+bool FindTransactionsByDestinations(const CAddrIndexView &view, const std::vector<CTxDestination> &vDest, std::vector<CExtDiskTxPos> &vpos,
+                                    int nMinHeight = 0, int nMaxHeight = std::numeric_limits<int>::max(),
+                                    size_t nSkip = 0, size_t nLimit = std::numeric_limits<size_t>::max(), bool fReverse = false);
+/** Find the unspent outputs of the viewed chain, which are spendable by dest, see CAddrIndexDB::ReadAddrUnspentIndex for the selection */
+bool FindUnspentByDestination(const CAddrIndexView &view, const CTxDestination &dest, std::vector<std::pair<COutPoint, CAddrUnspent> > &vUnspent,
+                              int nMinHeight = 0, const COutPoint *pafter = NULL, size_t nLimit = std::numeric_limits<size_t>::max());
+/** Read the summary of the transactions of an address from the address index */
+bool GetAddrSummary(const CAddrIndexView &view, const CTxDestination &dest, CAddrSummary &summary);
+/** Find the transactions of the memory pool, which are associated with an address, in the order they were accepted */
+bool FindMempoolTransactionsByDestination(const CTxDestination &dest, std::vector<CTransaction> &vtx);
+/** Find the transactions of the memory pool, which are associated with any of vDest, without duplicates */
+bool FindMempoolTransactionsByDestinations(const std::vector<CTxDestination> &vDest, std::vector<CTransaction> &vtx);
+/** Get the ids, under which an output script is found in the address index, see fAddrIndexPushes */
+void ExtractAddrIndexIds(const CScript &script, std::vector<uint160> &vAddrId);
+/**
+ * Collect all changes of a block to the address index, or those undoing them, if fRevert is set. The heights
+ * of restored unspent outputs, which the undo data only has for the last output of a transaction, are taken from view.
+ */
+void BuildAddrIndexUpdate(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fRevert,
+                          const CCoinsViewCache &view, CAddrIndexUpdate &update);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -428,8 +562,9 @@ bool FindTransactionsByDestination(const CTxDestination &dest, std::set<CExtDisk
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. Unless fJustCheck is set, the
+ *  entries of this block are also removed from the address index. */
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, bool fJustCheck = false);
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
@@ -576,6 +711,19 @@ public:
     bool VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
 };
 
+/**
+ * Enable the address index on a block database, or change whether it holds data pushes. It is
+ * (re)built by ThreadAddrIndexSync.
+ */
+bool EnableAddrIndex(bool fPushes);
+/**
+ * Prepare the address index for the active chain: start it over if it is missing parts or of an
+ * earlier version, and undo the blocks it covers, which are not in the active chain (any more).
+ */
+bool InitAddrIndex();
+/** Fill in the address index from the block and undo files, until it covers the active chain */
+void ThreadAddrIndexSync();
+
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
@@ -591,9 +739,18 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the compact coin cache below pcoinsTip, if -compactcoincache is set */
+extern CCoinsViewCompact *pcoinscompact;
+
+/** Global variable that points to the background writer of the coin database, if -backgroundflush is set */
+extern CCoinsViewDBWriter *pcoinswriter;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the address index database, if -addrindex is set (written under cs_main) */
+extern CAddrIndexDB *paddrindex;
+
 struct CBlockTemplate
 {
     CBlock block;
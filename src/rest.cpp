@@ -3,6 +3,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
+#include "core_io.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
@@ -12,6 +14,8 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <algorithm>
+
 #include <boost/algorithm/string.hpp>
 
 using namespace std;
@@ -34,6 +38,10 @@ static const struct {
       {RF_JSON, "json"},
 };
 
+/** Number of entries returned by the address endpoints, unless a limit is given, and their maximal limit */
+static const int DEFAULT_REST_ADDRESS_LIMIT = 1000;
+static const int MAX_REST_ADDRESS_LIMIT = 10000;
+
 class RestErr
 {
 public:
@@ -89,6 +97,36 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+/** Split the query string off strReq, and parse its name=value pairs */
+static void ParseQueryString(string& strReq, map<string, string>& mapQuery)
+{
+    size_t nPos = strReq.find('?');
+    if (nPos == string::npos)
+        return;
+    vector<string> vPairs;
+    string strQuery = strReq.substr(nPos + 1);
+    boost::split(vPairs, strQuery, boost::is_any_of("&"));
+    strReq.erase(nPos);
+    BOOST_FOREACH(const string& strPair, vPairs) {
+        size_t nEq = strPair.find('=');
+        if (nEq == string::npos)
+            mapQuery[strPair] = "";
+        else
+            mapQuery[strPair.substr(0, nEq)] = strPair.substr(nEq + 1);
+    }
+}
+
+static int ParseQueryInt(const map<string, string>& mapQuery, const string& strName, int nDefault, int nMin, int nMax)
+{
+    map<string, string>::const_iterator it = mapQuery.find(strName);
+    if (it == mapQuery.end())
+        return nDefault;
+    int32_t n;
+    if (!ParseInt32(it->second, &n) || n < nMin || n > nMax)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Invalid %s: %s (allowed: %d to %d)", strName, it->second, nMin, nMax));
+    return n;
+}
+
 static bool rest_block(AcceptedConnection* conn,
                        string& strReq,
                        map<string, string>& mapHeaders,
@@ -214,6 +252,276 @@ static bool rest_tx(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Transaction of an address, as returned by /rest/address/<address>/txs */
+struct CRestAddressTx
+{
+    int nHeight;
+    uint256 hashBlock;
+    CTransaction tx;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nHeight);
+        READWRITE(hashBlock);
+        READWRITE(tx);
+    }
+};
+
+/** Unspent output of an address, as returned by /rest/address/<address>/utxos */
+struct CRestAddressUtxo
+{
+    COutPoint outpoint;
+    int nHeight;
+    CTxOut txout;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(outpoint);
+        READWRITE(nHeight);
+        READWRITE(txout);
+    }
+};
+
+/**
+ * Position, from which the next page of an address endpoint continues: the number of entries
+ * to skip from a height on for transactions, and the last outpoint read for unspent outputs,
+ * which are listed in the order of their outpoints.
+ */
+struct CRestAddressCursor
+{
+    bool fMore;
+    int nFromHeight;
+    int nFromIndex;
+    COutPoint afterOutpoint;
+
+    CRestAddressCursor() : fMore(false), nFromHeight(0), nFromIndex(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(fMore);
+        if (fMore) {
+            READWRITE(nFromHeight);
+            READWRITE(nFromIndex);
+            READWRITE(afterOutpoint);
+        }
+    }
+};
+
+/**
+ * Read at most nLimit confirmed transactions of dest from nFromHeight on, after skipping the
+ * first nFromIndex of them, and set next to where the following page starts.
+ */
+static void GetAddressTxs(const CAddrIndexView& view, const CTxDestination& dest, int nFromHeight, int nFromIndex, int nLimit,
+                          vector<CRestAddressTx>& vTx, CRestAddressCursor& next)
+{
+    vector<CExtDiskTxPos> vpos;
+    if (!FindTransactionsByDestination(view, dest, vpos, nFromHeight, view.Height(), nFromIndex, nLimit))
+        throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Cannot search for address");
+
+    // The cursor counts the entries of the last height read, which include those of
+    // earlier pages, if the page did not leave that height.
+    if (vpos.size() == (size_t)nLimit) {
+        const unsigned int nLastHeight = vpos.back().nHeight;
+        size_t nHave = 0;
+        while (nHave < vpos.size() && vpos[vpos.size() - 1 - nHave].nHeight == nLastHeight)
+            nHave++;
+        next.fMore = true;
+        next.nFromHeight = nLastHeight;
+        next.nFromIndex = nHave + (next.nFromHeight == nFromHeight ? nFromIndex : 0);
+    }
+
+    // Every entry is counted by the cursor, so one, which is not part of the viewed chain,
+    // is reported, rather than left out of a page, which would look like the last one.
+    vTx.reserve(vpos.size());
+    BOOST_FOREACH(const CExtDiskTxPos& pos, vpos) {
+        const CBlockIndex* pindex = view.GetBlock(pos);
+        if (!pindex)
+            throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Address index entry is not part of the active chain");
+        vTx.push_back(CRestAddressTx());
+        CRestAddressTx& entry = vTx.back();
+        if (!ReadTransaction(entry.tx, pos, pindex))
+            throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Cannot read transaction from disk");
+        entry.nHeight = pindex->nHeight;
+        entry.hashBlock = pindex->GetBlockHash();
+    }
+}
+
+/**
+ * Read at most nLimit unspent outputs of dest from nFromHeight on, in the order of their
+ * outpoints, starting after pafter, if given, and set next to where the following page starts.
+ */
+static void GetAddressUtxos(const CAddrIndexView& view, const CTxDestination& dest, int nFromHeight, const COutPoint* pafter, int nLimit,
+                            vector<CRestAddressUtxo>& vUtxo, CRestAddressCursor& next)
+{
+    // Outputs without value are left out, so more are read, until the page is full, or
+    // there are no more, which a shorter page then tells the client.
+    COutPoint after;
+    while (vUtxo.size() < (size_t)nLimit) {
+        size_t nRequested = nLimit - vUtxo.size();
+        vector<pair<COutPoint, CAddrUnspent> > vUnspent;
+        if (!FindUnspentByDestination(view, dest, vUnspent, nFromHeight, pafter, nRequested))
+            throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Cannot search for address");
+        vector<pair<COutPoint, CAddrUnspent> >::const_iterator it = vUnspent.begin();
+        for (; it != vUnspent.end(); it++) {
+            if (it->second.txout.nValue <= 0)
+                continue;
+            vUtxo.push_back(CRestAddressUtxo());
+            CRestAddressUtxo& entry = vUtxo.back();
+            entry.outpoint = it->first;
+            entry.nHeight = it->second.nHeight;
+            entry.txout = it->second.txout;
+        }
+        if (vUnspent.size() < nRequested)
+            return;
+        after = vUnspent.back().first;
+        pafter = &after;
+    }
+
+    next.fMore = true;
+    next.nFromHeight = nFromHeight;
+    next.afterOutpoint = *pafter;
+}
+
+/** Parse an outpoint given as <txid>-<n> */
+static bool ParseOutPoint(const string& str, COutPoint& outpoint)
+{
+    size_t nSep = str.find('-');
+    if (nSep != 64 || !IsHex(str.substr(0, nSep)))
+        return false;
+    int32_t n;
+    if (!ParseInt32(str.substr(nSep + 1), &n) || n < 0)
+        return false;
+    uint256 hash;
+    hash.SetHex(str.substr(0, nSep));
+    outpoint = COutPoint(hash, n);
+    return true;
+}
+
+/**
+ * Serve the confirmed transactions or unspent outputs of an address from the address index:
+ * /rest/address/<address>/txs.{bin|hex|json}?from_height=<height>&from_index=<count>&limit=<count>
+ * /rest/address/<address>/utxos.{bin|hex|json}?from_height=<height>&after_outpoint=<txid>-<n>&limit=<count>
+ * At most limit entries are returned, along with the parameters of the next page, if there may be one.
+ */
+static bool rest_address(AcceptedConnection* conn,
+                         string& strReq,
+                         map<string, string>& mapHeaders,
+                         bool fRun)
+{
+    map<string, string> mapQuery;
+    ParseQueryString(strReq, mapQuery);
+
+    vector<string> path;
+    boost::split(path, strReq, boost::is_any_of("/"));
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/address/<address>/txs or /rest/address/<address>/utxos");
+
+    CBitcoinAddress address(path[0]);
+    if (!address.IsValid())
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid address: " + path[0]);
+    CTxDestination dest = address.Get();
+
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, path[1]);
+    bool fTxs = (params[0] == "txs");
+    if (!fTxs && params[0] != "utxos")
+        throw RESTERR(HTTP_NOT_FOUND, "Unknown resource: " + params[0] + " (available: txs, utxos)");
+    if (rf == RF_UNDEF)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    int nFromHeight = ParseQueryInt(mapQuery, "from_height", 0, 0, std::numeric_limits<int>::max());
+    int nFromIndex = ParseQueryInt(mapQuery, "from_index", 0, 0, std::numeric_limits<int>::max());
+    int nLimit = ParseQueryInt(mapQuery, "limit", DEFAULT_REST_ADDRESS_LIMIT, 1, MAX_REST_ADDRESS_LIMIT);
+    COutPoint afterOutpoint;
+    bool fAfter = mapQuery.count("after_outpoint") > 0;
+    if (fAfter && !ParseOutPoint(mapQuery["after_outpoint"], afterOutpoint))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid after_outpoint: " + mapQuery["after_outpoint"] + " (expected: <txid>-<n>)");
+
+    // Only the view is taken under cs_main, the index and the transactions are read from it.
+    CAddrIndexView view;
+    {
+        LOCK(cs_main);
+        if (!fAddrIndex || !GetAddrIndexView(view))
+            throw RESTERR(HTTP_NOT_FOUND, "Address index not enabled");
+        if (pindexAddrIndexBest != chainActive.Tip())
+            throw RESTERR(HTTP_SERVICE_UNAVAILABLE, strprintf("Address index is syncing, up to height %d of %d",
+                                                              view.Height(), chainActive.Height()));
+    }
+
+    vector<CRestAddressTx> vTx;
+    vector<CRestAddressUtxo> vUtxo;
+    CRestAddressCursor next;
+    if (fTxs)
+        GetAddressTxs(view, dest, nFromHeight, nFromIndex, nLimit, vTx, next);
+    else
+        GetAddressUtxos(view, dest, nFromHeight, fAfter ? &afterOutpoint : NULL, nLimit, vUtxo, next);
+
+    if (rf == RF_JSON) {
+        Array entries;
+        if (fTxs) {
+            BOOST_FOREACH(const CRestAddressTx& entry, vTx) {
+                Object obj;
+                obj.push_back(Pair("txid", entry.tx.GetHash().GetHex()));
+                obj.push_back(Pair("height", entry.nHeight));
+                obj.push_back(Pair("blockhash", entry.hashBlock.GetHex()));
+                obj.push_back(Pair("hex", EncodeHexTx(entry.tx)));
+                entries.push_back(obj);
+            }
+        } else {
+            BOOST_FOREACH(const CRestAddressUtxo& entry, vUtxo) {
+                Object obj;
+                obj.push_back(Pair("txid", entry.outpoint.hash.GetHex()));
+                obj.push_back(Pair("vout", (int64_t)entry.outpoint.n));
+                obj.push_back(Pair("height", entry.nHeight));
+                obj.push_back(Pair("value", ValueFromAmount(entry.txout.nValue)));
+                obj.push_back(Pair("scriptPubKey", HexStr(entry.txout.scriptPubKey.begin(), entry.txout.scriptPubKey.end())));
+                entries.push_back(obj);
+            }
+        }
+        Object objResult;
+        objResult.push_back(Pair("height", view.Height()));
+        objResult.push_back(Pair("tip", view.pindexTip->GetBlockHash().GetHex()));
+        objResult.push_back(Pair(params[0], entries));
+        if (next.fMore) {
+            Object objNext;
+            objNext.push_back(Pair("from_height", next.nFromHeight));
+            if (fTxs)
+                objNext.push_back(Pair("from_index", next.nFromIndex));
+            else
+                objNext.push_back(Pair("after_outpoint", next.afterOutpoint.hash.GetHex() + strprintf("-%u", next.afterOutpoint.n)));
+            objResult.push_back(Pair("next", objNext));
+        }
+        string strJSON = write_string(Value(objResult), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    // The binary result starts with the height and hash of the viewed tip, followed by the
+    // entries and the cursor of the next page.
+    CDataStream ssResult(SER_NETWORK, PROTOCOL_VERSION);
+    ssResult << view.Height() << view.pindexTip->GetBlockHash();
+    if (fTxs)
+        ssResult << vTx;
+    else
+        ssResult << vUtxo;
+    ssResult << next;
+
+    if (rf == RF_BINARY) {
+        string binaryResult = ssResult.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryResult.size(), "application/octet-stream") << binaryResult << std::flush;
+    } else {
+        string strHex = HexStr(ssResult.begin(), ssResult.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+    }
+    return true;
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
@@ -222,6 +530,7 @@ static const struct {
                     bool fRun);
 } uri_prefixes[] = {
       {"/rest/tx/", rest_tx},
+      {"/rest/address/", rest_address},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
 };
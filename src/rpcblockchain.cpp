@@ -4,9 +4,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "checkpoints.h"
+#include "coinscompact.h"
 #include "main.h"
 #include "rpcserver.h"
+#include "script/standard.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -310,7 +313,8 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
         throw runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time. The set is read on several threads (see -par), and blocks\n"
+            "are connected meanwhile.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -318,8 +322,20 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The hash of the best block and the serialized hashes of the\n"
+            "                                   256 shards of transactions, whose txids start with the same byte\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"scripttypes\": {               (json object) The number of outputs by script type\n"
+            "      \"type\": n,                 (numeric) The number of outputs with type (e.g. 'pubkeyhash', 'scripthash')\n"
+            "      ,...\n"
+            "  },\n"
+            "  \"values\": [                    (array of json objects) The number of outputs by value\n"
+            "    {\n"
+            "      \"minvalue\": x.xxx,         (numeric) The outputs of 0, or from minvalue to below ten times minvalue\n"
+            "      \"txouts\": n                (numeric) The number of outputs\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
@@ -328,9 +344,20 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
 
     Object ret;
 
+    // cs_main is only held to flush the coins and to find the height of the block they were
+    // read at: they are read from a snapshot of the database, while blocks are connected.
     CCoinsStats stats;
-    FlushStateToDisk();
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+    }
     if (pcoinsTip->GetStats(stats)) {
+        {
+            LOCK(cs_main);
+            BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+            if (it != mapBlockIndex.end())
+                stats.nHeight = it->second->nHeight;
+        }
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
@@ -338,6 +365,23 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        Object types;
+        for (unsigned int i = 0; i < stats.vScriptTypeCount.size(); i++) {
+            if (stats.vScriptTypeCount[i] > 0)
+                types.push_back(Pair(GetTxnOutputType((txnouttype)i), (int64_t)stats.vScriptTypeCount[i]));
+        }
+        ret.push_back(Pair("scripttypes", types));
+        Array values;
+        CAmount nMinValue = 0;
+        for (unsigned int i = 0; i < stats.vValueCount.size(); i++, nMinValue = nMinValue ? nMinValue * 10 : 1) {
+            if (stats.vValueCount[i] == 0)
+                continue;
+            Object value;
+            value.push_back(Pair("minvalue", ValueFromAmount(nMinValue)));
+            value.push_back(Pair("txouts", (int64_t)stats.vValueCount[i]));
+            values.push_back(value);
+        }
+        ret.push_back(Pair("values", values));
     }
     return ret;
 }
@@ -604,6 +648,41 @@ Value getmempoolinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+Value getcoincacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcoincacheinfo\n"
+            "\nReturns details on the in-memory caches of the unspent transaction output set.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": xxxxx                (numeric) Current count of transactions in the coins cache\n"
+            "  \"usage\": xxxxx               (numeric) Memory taken by the coins cache, in bytes\n"
+            "  \"maxusage\": xxxxx            (numeric) Memory usage above which the coins cache is flushed, in bytes\n"
+            "  \"compactsize\": xxxxx         (numeric) Count of transactions in the compact coin cache (only with -compactcoincache)\n"
+            "  \"compactusage\": xxxxx        (numeric) Memory taken by the compact coin cache, in bytes (only with -compactcoincache)\n"
+            "  \"writingusage\": xxxxx        (numeric) Memory taken by coins, which are being written to the database, in bytes (only with -backgroundflush)\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcoincacheinfo", "")
+            + HelpExampleRpc("getcoincacheinfo", "")
+        );
+
+    LOCK(cs_main);
+    Object ret;
+    ret.push_back(Pair("size", (int64_t) pcoinsTip->GetCacheSize()));
+    ret.push_back(Pair("usage", (int64_t) pcoinsTip->DynamicMemoryUsage()));
+    ret.push_back(Pair("maxusage", (int64_t) nCoinCacheUsage));
+    if (pcoinscompact) {
+        ret.push_back(Pair("compactsize", (int64_t) pcoinscompact->GetCount()));
+        ret.push_back(Pair("compactusage", (int64_t) pcoinscompact->DynamicMemoryUsage()));
+    }
+    if (pcoinswriter)
+        ret.push_back(Pair("writingusage", (int64_t) pcoinswriter->DynamicMemoryUsage()));
+
+    return ret;
+}
+
 Value invalidateblock(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
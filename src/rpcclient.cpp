@@ -94,12 +94,16 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "searchrawtransactions", 2 },
     { "searchrawtransactions", 3 },
     { "searchrawtransactions", 4 },
+    { "searchrawtransactions", 5 },
     { "listallunspent", 1 },
     { "listallunspent", 2 },
     { "listallunspent", 3 },
     { "listallunspent", 4 },
+    { "listallunspent", 5 },
     { "getallbalance", 1 },
     { "getallbalance", 2 },
+    { "getallbalance", 3 },
+    { "getaddrindexinfo", 0 },
 };
 
 class CRPCConvertTable
@@ -117,6 +117,24 @@ string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const
         FormatFullVersion());
 }
 
+string HTTPReplyHeaderChunked(int nStatus, bool keepalive, const char *contentType)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: %s\r\n"
+            "Server: bitcoin-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        httpStatusDescription(nStatus),
+        rfc1123Time(),
+        keepalive ? "keep-alive" : "close",
+        contentType,
+        FormatFullVersion());
+}
+
 string HTTPReply(int nStatus, const string& strMsg, bool keepalive,
                  bool headersOnly, const char *contentType)
 {
@@ -217,7 +235,38 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    if (boost::iequals(mapHeadersRet["transfer-encoding"], "chunked"))
+    {
+        // Every chunk is preceded by its size in hex, and an empty chunk ends the message
+        while (true)
+        {
+            string str;
+            std::getline(stream, str);
+            char *pend;
+            unsigned long nChunk = strtoul(str.c_str(), &pend, 16);
+            if (!stream || pend == str.c_str())
+                return HTTP_INTERNAL_SERVER_ERROR;
+            if (nChunk == 0)
+                break;
+            if (nChunk > max_size - strMessageRet.size())
+                return HTTP_INTERNAL_SERVER_ERROR;
+            while (nChunk > 0)
+            {
+                size_t bytes_to_read = std::min((size_t)nChunk, POST_READ_SIZE);
+                size_t ptr = strMessageRet.size();
+                strMessageRet.resize(ptr + bytes_to_read);
+                stream.read(&strMessageRet[ptr], bytes_to_read);
+                if (!stream) // Connection lost while reading
+                    return HTTP_INTERNAL_SERVER_ERROR;
+                nChunk -= bytes_to_read;
+            }
+            std::getline(stream, str);
+        }
+        // Skip trailing headers, up to the empty line
+        map<string, string> mapTrailers;
+        ReadHTTPHeaders(stream, mapTrailers);
+    }
+    else if (nLen > 0)
     {
         vector<char> vch;
         size_t ptr = 0;
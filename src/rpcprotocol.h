@@ -13,6 +13,7 @@
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
+template <typename T> boost::asio::io_context& GetIOService(T& t) { return (boost::asio::io_context&)t.get_executor().context(); }
 #include <boost/asio/ssl.hpp>
 
 #include "json/json_spirit_reader_template.h"
@@ -111,7 +112,7 @@ public:
     bool connect(const std::string& server, const std::string& port)
     {
         using namespace boost::asio::ip;
-        tcp::resolver resolver(stream.get_io_service());
+        tcp::resolver resolver(GetIOService(stream));
         tcp::resolver::iterator endpoint_iterator;
 #if BOOST_VERSION >= 104300
         try {
@@ -152,6 +153,9 @@ std::string HTTPError(int nStatus, bool keepalive,
                       bool headerOnly = false);
 std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength,
                       const char *contentType = "application/json");
+/** Header of a reply, whose body follows in chunks of the chunked transfer encoding */
+std::string HTTPReplyHeaderChunked(int nStatus, bool keepalive,
+                      const char *contentType = "application/json");
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive,
                       bool headerOnly = false,
                       const char *contentType = "application/json");
@@ -14,6 +14,7 @@
 #include "script/script.h"
 #include "script/sign.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #ifdef ENABLE_WALLET
 #include "wallet.h"
@@ -54,7 +55,8 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeH
     out.push_back(Pair("addresses", a));
 }
 
-void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
+/** Describe tx of the block pindex, whose confirmations are counted in the chain up to pindexTip */
+static void TxToJSON(const CTransaction& tx, const uint256 hashBlock, const CBlockIndex* pindex, const CBlockIndex* pindexTip, Object& entry)
 {
     entry.push_back(Pair("txid", tx.GetHash().GetHex()));
     entry.push_back(Pair("version", tx.nVersion));
@@ -91,11 +93,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
 
     if (hashBlock != 0) {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-        if (mi != mapBlockIndex.end() && (*mi).second) {
-            CBlockIndex* pindex = (*mi).second;
-            if (chainActive.Contains(pindex)) {
-                entry.push_back(Pair("confirmations", 1 + chainActive.Height() - pindex->nHeight));
+        if (pindex) {
+            if (pindexTip && pindexTip->GetAncestor(pindex->nHeight) == pindex) {
+                entry.push_back(Pair("confirmations", 1 + pindexTip->nHeight - pindex->nHeight));
                 entry.push_back(Pair("time", pindex->GetBlockTime()));
                 entry.push_back(Pair("blocktime", pindex->GetBlockTime()));
             }
@@ -105,6 +105,17 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     }
 }
 
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
+{
+    CBlockIndex* pindex = NULL;
+    if (hashBlock != 0) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end())
+            pindex = (*mi).second;
+    }
+    TxToJSON(tx, hashBlock, pindex, chainActive.Tip(), entry);
+}
+
 Value getrawtransaction(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -762,43 +773,80 @@ Value sendrawtransaction(const Array& params, bool fHelp)
 // Address index extensions
 //
 
-Value searchrawtransactions(const Array &params, bool fHelp)
+/**
+ * Take a view of the address index, which queries read without holding cs_main, and throw,
+ * unless the index is enabled and covers the active chain
+ */
+static void EnsureAddrIndex(CAddrIndexView &view)
 {
-    if (fHelp || params.size() < 1 || params.size() > 5)
+    LOCK(cs_main);
+    if (!fAddrIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+    if (pindexAddrIndexBest != chainActive.Tip())
+        throw JSONRPCError(RPC_IN_WARMUP, strprintf("Address index is syncing, up to height %d of %d",
+                                                    pindexAddrIndexBest ? pindexAddrIndexBest->nHeight : -1, chainActive.Height()));
+    if (!GetAddrIndexView(view))
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+}
+
+static void SearchResultPush(CRPCArrayWriter &result, const CTransaction &tx, const uint256 &hashBlock, const CBlockIndex *pindex,
+                             const CAddrIndexView &view, bool fVerbose)
+{
+    std::string strHex = EncodeHexTx(tx);
+
+    if (fVerbose) {
+        Object entry;
+        entry.push_back(Pair("hex", strHex));
+        TxToJSON(tx, hashBlock, pindex, view.pindexTip, entry);
+        result.push_back(entry);
+    } else {
+        result.push_back(strHex);
+    }
+}
+
+void searchrawtransactions(const Array &params, bool fHelp, CRPCArrayWriter &result)
+{
+    if (fHelp || params.size() < 1 || params.size() > 6)
         throw runtime_error(
-            "searchrawtransactions \"address\" ( verbose skip count includeorphans )\n"
+            "searchrawtransactions \"address\"|[\"address\",...] ( verbose skip count includeorphans includemempool )\n"
 
-            "\nReturns an array of all confirmed transactions associated with address.\n"
+            "\nReturns an array of all confirmed transactions associated with address, or with any of"
+            " the addresses, in which case every transaction is returned once.\n"
 
-            "\nNote: as per default, orphaned transactions, which are not part of the"
-            "active chain, are included in the results.\n"
+            "\nNote: transactions of blocks, which are disconnected from the active chain,"
+            " are removed from the index. Orphaned transactions may only be included, if"
+            " they were indexed by an earlier version. Unconfirmed transactions follow the"
+            " confirmed ones, in the order they were accepted.\n"
 
             "\nArguments:\n"
-            "1. address          (string, required) The Bitcoin address\n"
+            "1. address          (string or array, required) The Bitcoin address, or an array of addresses\n"
             "2. verbose          (numeric, optional, default=1) If 0, return only transaction hex\n"
             "3. skip             (numeric, optional, default=0) The number of transactions to skip\n"
             "4. count            (numeric, optional, default=100) The number of transactions to return\n"
             "5. includeorphans   (numeric, optional, default=1) If 0, exclude orphaned transactions\n"
+            "6. includemempool   (numeric, optional, default=0) If 1, include unconfirmed transactions\n"
 
             "\nExamples\n"
             + HelpExampleCli("searchrawtransactions", "1EXoDusjGwvnjZUyKkxZ4UHEf77z6A5S4P")
             + HelpExampleCli("searchrawtransactions", "1EXoDusjGwvnjZUyKkxZ4UHEf77z6A5S4P 1 500 5 0")
+            + HelpExampleCli("searchrawtransactions", "1EXoDusjGwvnjZUyKkxZ4UHEf77z6A5S4P 1 -10 10 1 1")
             + HelpExampleRpc("searchrawtransactions", "1EXoDusjGwvnjZUyKkxZ4UHEf77z6A5S4P, 1, 500, 5, 0")
+            + HelpExampleRpc("searchrawtransactions", "[\"1EXoDusjGwvnjZUyKkxZ4UHEf77z6A5S4P\", \"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\"], 1, 0, 100")
         );
 
-    if (!fAddrIndex)
-        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+    bool fMulti = params[0].type() == array_type;
+    RPCTypeCheck(params, list_of(fMulti ? array_type : str_type)(int_type)(int_type)(int_type)(int_type)(int_type));
 
-    RPCTypeCheck(params, list_of(str_type)(int_type)(int_type)(int_type)(int_type));
-
-    CBitcoinAddress address(params[0].get_str());
-    if (!address.IsValid())
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
-    CTxDestination dest = address.Get();
-
-    std::set<CExtDiskTxPos> setpos;
-    if (!FindTransactionsByDestination(dest, setpos))
-        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+    std::vector<CTxDestination> vDest;
+    Array addresses = fMulti ? params[0].get_array() : Array(1, params[0]);
+    BOOST_FOREACH(const Value &value, addresses) {
+        CBitcoinAddress address(value.get_str());
+        if (!address.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address: " + value.get_str());
+        vDest.push_back(address.Get());
+    }
+    if (vDest.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "No addresses given");
 
     bool fVerbose = true;
     if (params.size() > 1)
@@ -807,8 +855,8 @@ Value searchrawtransactions(const Array &params, bool fHelp)
     int nSkip = 0;
     if (params.size() > 2)
         nSkip = params[2].get_int();
-    if (nSkip < 0)
-        nSkip += setpos.size();
+    if (nSkip < -std::numeric_limits<int>::max())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Skip out of range");
 
     int nCount = 100;
     if (params.size() > 3)
@@ -818,58 +866,210 @@ Value searchrawtransactions(const Array &params, bool fHelp)
     if (params.size() > 4)
         fIncludeOrphans = (params[4].get_int() != 0);
 
-    std::set<CExtDiskTxPos>::const_iterator it = setpos.begin();
-    while (it != setpos.end() && nSkip--)
-        it++;
-
-    Array result;
-    while (it != setpos.end() && nCount > 0) {
-        CTransaction tx;
-        uint256 hashBlock;
-        if (!ReadTransaction(tx, *it, hashBlock))
-            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
-
-        bool fOrphaned = true;
-        if (!fIncludeOrphans && hashBlock != 0) {
-            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-            if (mi != mapBlockIndex.end() && (*mi).second) {
-                CBlockIndex* pindex = (*mi).second;
-                fOrphaned = !chainActive.Contains(pindex);
-            }
+    bool fIncludeMempool = false;
+    if (params.size() > 5)
+        fIncludeMempool = (params[5].get_int() != 0);
+
+    // The index is read from a view, so that cs_main is only held while the view and the
+    // memory pool are taken, which together hold every transaction exactly once.
+    CAddrIndexView view;
+    std::vector<CTransaction> vtxMempool;
+    {
+        LOCK(cs_main);
+        EnsureAddrIndex(view);
+        if (fIncludeMempool && !FindMempoolTransactionsByDestinations(vDest, vtxMempool))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+    }
+
+    // A negative skip selects the last entries, of which unconfirmed transactions are
+    // the newest. Otherwise the skipped confirmed transactions are counted by the
+    // address summary, or, for several addresses, which may share transactions, by
+    // reading up to skip of their entries, to know how many unconfirmed ones are skipped.
+    size_t nLast = 0;
+    size_t nSkipMempool = 0;
+    if (nSkip < 0) {
+        nLast = -nSkip;
+        size_t nLastMempool = std::min(nLast, vtxMempool.size());
+        vtxMempool.erase(vtxMempool.begin(), vtxMempool.end() - nLastMempool);
+        nLast -= nLastMempool;
+    } else if (nSkip > 0 && !vtxMempool.empty()) {
+        size_t nConfirmed;
+        if (vDest.size() == 1) {
+            CAddrSummary summary;
+            if (!GetAddrSummary(view, vDest[0], summary))
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+            nConfirmed = summary.nTxCount;
+        } else {
+            std::vector<CExtDiskTxPos> vpos;
+            if (!FindTransactionsByDestinations(view, vDest, vpos, 0, std::numeric_limits<int>::max(), 0, nSkip))
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+            nConfirmed = vpos.size();
         }
-        if (!fIncludeOrphans && fOrphaned) {
-            it++;
-            continue;
+        if ((size_t)nSkip > nConfirmed)
+            nSkipMempool = nSkip - nConfirmed;
+    }
+
+    size_t nOffset = std::max(nSkip, 0);
+    while (nCount > 0 && (nSkip >= 0 || nLast > 0)) {
+        // Only the requested page is read from the index. If orphaned transactions are
+        // excluded, further pages are read, until enough transactions were collected.
+        std::vector<CExtDiskTxPos> vpos;
+        size_t nRequested = nCount;
+        if (nSkip < 0) {
+            // read the last entries newest first
+            nRequested = nLast;
+            if (!FindTransactionsByDestinations(view, vDest, vpos, 0, std::numeric_limits<int>::max(), 0, nRequested, true))
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+            std::reverse(vpos.begin(), vpos.end());
+        } else {
+            if (!FindTransactionsByDestinations(view, vDest, vpos, 0, std::numeric_limits<int>::max(), nOffset, nRequested))
+                throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
         }
 
-        std::string strHex = EncodeHexTx(tx);
+        std::vector<CExtDiskTxPos>::const_iterator it = vpos.begin();
+        while (it != vpos.end() && nCount > 0) {
+            // The block of an entry is found by its height and position in the viewed
+            // chain, so its header is only read, if the entry is orphaned.
+            CTransaction tx;
+            uint256 hashBlock;
+            const CBlockIndex* pindex = view.GetBlock(*it);
+            if (pindex) {
+                if (!ReadTransaction(tx, *it, pindex))
+                    throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
+                hashBlock = pindex->GetBlockHash();
+            } else {
+                if (!fIncludeOrphans) {
+                    it++;
+                    continue;
+                }
+                if (!ReadTransaction(tx, *it, hashBlock))
+                    throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
+                LOCK(cs_main);
+                BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+                if (mi != mapBlockIndex.end())
+                    pindex = (*mi).second;
+            }
 
-        if (fVerbose) {
-            Object entry;
-            entry.push_back(Pair("hex", strHex));
-            TxToJSON(tx, hashBlock, entry);
-            result.push_back(entry);
-        } else {
-            result.push_back(strHex);
+            SearchResultPush(result, tx, hashBlock, pindex, view, fVerbose);
+            nCount--;
+            it++;
         }
 
-        nCount--;
-        it++;
+        if (nSkip < 0 || vpos.size() < nRequested)
+            break;
+        nOffset += vpos.size();
     }
 
-    return result;
+    for (size_t i = nSkipMempool; i < vtxMempool.size() && nCount > 0; i++, nCount--)
+        SearchResultPush(result, vtxMempool[i], 0, NULL, view, fVerbose);
 }
 
-Value listallunspent(const Array &params, bool fHelp)
+/** Number of unspent outputs, which are read from the address index at once */
+static const size_t ADDRINDEX_UNSPENT_PAGE = 1000;
+
+/**
+ * Find the outputs, which unconfirmed transactions of an address spend, and the unconfirmed
+ * outputs of the address, which are not spent by the memory pool, at nHeight.
+ */
+static void GetMempoolUnspent(const CTxDestination &dest, int nHeight, std::set<COutPoint> &setSpent,
+                              std::vector<std::pair<COutPoint, CAddrUnspent> > &vUnspent)
+{
+    std::vector<CTransaction> vtxMempool;
+    if (!FindMempoolTransactionsByDestination(dest, vtxMempool))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+
+    LOCK(mempool.cs);
+    BOOST_FOREACH(const CTransaction &tx, vtxMempool) {
+        BOOST_FOREACH(const CTxIn &txin, tx.vin)
+            setSpent.insert(txin.prevout);
+        uint256 hash = tx.GetHash();
+        for (unsigned int n = 0; n < tx.vout.size(); n++) {
+            COutPoint outpoint(hash, n);
+            if (mempool.mapNextTx.count(outpoint))
+                continue;
+            txnouttype type;
+            vector<CTxDestination> addresses;
+            int nRequired;
+            if (!ExtractDestinations(tx.vout[n].scriptPubKey, type, addresses, nRequired))
+                continue;
+            if (std::find(addresses.begin(), addresses.end(), dest) == addresses.end())
+                continue;
+            vUnspent.push_back(std::make_pair(outpoint, CAddrUnspent(tx.vout[n], nHeight)));
+        }
+    }
+}
+
+/**
+ * Reader of the unspent outputs of an address, from a view of the address index, which are
+ * read in pages in the order of their outpoints without holding cs_main. If they are brought
+ * up to date with the memory pool, outputs spent by unconfirmed transactions are skipped, and
+ * the unconfirmed outputs follow, as found when the view was taken.
+ */
+class CAddrUnspentReader
+{
+private:
+    CTxDestination dest;
+    int nMinHeight;
+    std::vector<std::pair<COutPoint, CAddrUnspent> > vPage;
+    size_t nPage;
+    bool fMore;
+    std::set<COutPoint> setSpent;
+    std::vector<std::pair<COutPoint, CAddrUnspent> > vMempool;
+    size_t nMempool;
+
+public:
+    CAddrIndexView view;
+
+    /** Take the view, and select the outputs with at most nMaxDepth confirmations */
+    CAddrUnspentReader(const CTxDestination &destIn, bool fIncludeMempool, int nMaxDepth = std::numeric_limits<int>::max()) :
+        dest(destIn), nPage(0), fMore(true), nMempool(0)
+    {
+        LOCK(cs_main);
+        EnsureAddrIndex(view);
+        nMinHeight = view.Height() + 1 - std::max(nMaxDepth, 0);
+        if (fIncludeMempool)
+            GetMempoolUnspent(dest, view.Height() + 1, setSpent, vMempool);
+    }
+
+    bool Next(std::pair<COutPoint, CAddrUnspent> &unspent)
+    {
+        while (nPage < vPage.size() || fMore) {
+            if (nPage == vPage.size()) {
+                // the next page continues after the last outpoint of the previous one
+                COutPoint after;
+                bool fAfter = !vPage.empty();
+                if (fAfter)
+                    after = vPage.back().first;
+                vPage.clear();
+                nPage = 0;
+                if (!FindUnspentByDestination(view, dest, vPage, nMinHeight, fAfter ? &after : NULL, ADDRINDEX_UNSPENT_PAGE))
+                    throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+                fMore = (vPage.size() == ADDRINDEX_UNSPENT_PAGE);
+                continue;
+            }
+            unspent = vPage[nPage++];
+            if (!setSpent.count(unspent.first))
+                return true;
+        }
+        if (nMempool < vMempool.size()) {
+            unspent = vMempool[nMempool++];
+            return true;
+        }
+        return false;
+    }
+};
+
+void listallunspent(const Array &params, bool fHelp, CRPCArrayWriter &results)
 {
-    if (fHelp || params.size() < 1 || params.size() > 5)
+    if (fHelp || params.size() < 1 || params.size() > 6)
         throw runtime_error(
-            "listallunspent \"address\" ( verbose minconf maxconf maxreqsigs )\n"
+            "listallunspent \"address\" ( verbose minconf maxconf maxreqsigs includemempool )\n"
 
             "\nReturns an array of confirmed, unspent transaction outputs with between"
             " minconf and maxconf (inclusive) confirmations, spendable by the provided"
             " address, whereby maximal maxreqsigs signatures are required to redeem the"
-            " output.\n"
+            " output. The outputs are listed in the order of their transaction ids and output"
+            " indexes, followed by unconfirmed outputs.\n"
 
             "\nArguments:\n"
             "1. address          (string, required) The Bitcoin address\n"
@@ -877,6 +1077,8 @@ Value listallunspent(const Array &params, bool fHelp)
             "3. minconf          (numeric, optional, default=1) The minimum confirmations to filter.\n"
             "4. maxconf          (numeric, optional, default=9999999) The maximum confirmations to filter\n"
             "5. maxreqsigs       (numeric, optional, default=1) The number of signatures required to spend the output\n"
+            "6. includemempool   (numeric, optional, default=0) If 1, exclude outputs spent by unconfirmed transactions,\n"
+            "                    and include unconfirmed outputs with 0 confirmations\n"
 
             "\nExamples\n"
             + HelpExampleCli("listallunspent", "1BxtgEa8UcrMzVZaW32zVyJh4Sg4KGFzxA")
@@ -884,20 +1086,13 @@ Value listallunspent(const Array &params, bool fHelp)
             + HelpExampleRpc("listallunspent", "1BxtgEa8UcrMzVZaW32zVyJh4Sg4KGFzxA, 1, 0, 100, 1")
         );
 
-    RPCTypeCheck(params, list_of(str_type)(int_type)(int_type)(int_type)(int_type));
-
-    if (!fAddrIndex)
-        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+    RPCTypeCheck(params, list_of(str_type)(int_type)(int_type)(int_type)(int_type)(int_type));
 
     CBitcoinAddress address(params[0].get_str());
     if (!address.IsValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
     CTxDestination dest = address.Get();
 
-    std::set<CExtDiskTxPos> setpos;
-    if (!FindTransactionsByDestination(dest, setpos))
-        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
-
     bool fVerbose = false;
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
@@ -914,86 +1109,68 @@ Value listallunspent(const Array &params, bool fHelp)
     if (params.size() > 4)
         nMaxReqSigs = params[4].get_int();
 
-    Array results;
-    std::set<CExtDiskTxPos>::const_iterator it = setpos.begin();
-    while (it != setpos.end()) {
-        CTransaction tx;
-        uint256 hashBlock;
-        if (!ReadTransaction(tx, *it, hashBlock))
-            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
-
-        CCoins coins;
-        pcoinsTip->GetCoins(tx.GetHash(), coins);
-        for (unsigned int n = 0; n < tx.vout.size(); n++) {
-            const CTxOut& txout = tx.vout[n];
-            if (!(coins.IsAvailable(n) && txout.nValue > 0))
-                continue;
-
-            txnouttype type;
-            vector<CTxDestination> addresses;
-            int nRequired;
-            if (!ExtractDestinations(txout.scriptPubKey, type, addresses, nRequired))
-                continue;
-            if (nMaxReqSigs < nRequired)
-                continue;
-            if (std::find(addresses.begin(), addresses.end(), dest) == addresses.end())
-                continue;
+    bool fIncludeMempool = false;
+    if (params.size() > 5)
+        fIncludeMempool = (params[5].get_int() != 0);
+
+    // Each output is written, as it is read, so that the outputs are never held at once.
+    CAddrUnspentReader reader(dest, fIncludeMempool, nMaxDepth);
+    const CAddrIndexView &view = reader.view;
+    std::pair<COutPoint, CAddrUnspent> unspent;
+    while (reader.Next(unspent)) {
+        const COutPoint& outpoint = unspent.first;
+        const CTxOut& txout = unspent.second.txout;
+        if (txout.nValue <= 0)
+            continue;
 
-            int nDepth = 0;
-            int nHeight = 0;
-            int64_t nTime = 0;
-            
-            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-            if (mi != mapBlockIndex.end() && (*mi).second) {
-                CBlockIndex* pindex = (*mi).second;
-                if (chainActive.Contains(pindex)) {
-                    nHeight = pindex->nHeight;
-                    nDepth = chainActive.Height() - nHeight + 1;
-                    nTime = pindex->GetBlockTime();
-                }
-            }
+        int nHeight = unspent.second.nHeight;
+        int nDepth = view.Height() - nHeight + 1;
+        if (nDepth < nMinDepth || nDepth > nMaxDepth)
+            continue;
 
-            if (nDepth < nMinDepth || nDepth > nMaxDepth)
-                continue;
+        txnouttype type;
+        vector<CTxDestination> addresses;
+        int nRequired;
+        if (!ExtractDestinations(txout.scriptPubKey, type, addresses, nRequired))
+            continue;
+        if (nMaxReqSigs < nRequired)
+            continue;
 
-            Object entry;
-            entry.push_back(Pair("txid", tx.GetHash().GetHex()));
-            entry.push_back(Pair("vout", (int64_t)n));
-            entry.push_back(Pair("amount", ValueFromAmount(txout.nValue)));
-            entry.push_back(Pair("type", GetTxnOutputType(type)));
-
-            if (fVerbose) {
-                entry.push_back(Pair("reqSigs", nRequired));
-                Array a;
-                BOOST_FOREACH(const CTxDestination& addrinner, addresses)
-                    a.push_back(CBitcoinAddress(addrinner).ToString());
-                entry.push_back(Pair("addresses", a));
-
-                Object pkobj;
-                const CScript& pk = txout.scriptPubKey;
-                pkobj.push_back(Pair("asm", pk.ToString()));
-                pkobj.push_back(Pair("hex", HexStr(pk.begin(), pk.end())));
-                entry.push_back(Pair("scriptPubKey", pkobj));
-
-                entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-                entry.push_back(Pair("blocktime", nTime));
-                entry.push_back(Pair("blockheight", nHeight));
-            }
+        Object entry;
+        entry.push_back(Pair("txid", outpoint.hash.GetHex()));
+        entry.push_back(Pair("vout", (int64_t)outpoint.n));
+        entry.push_back(Pair("amount", ValueFromAmount(txout.nValue)));
+        entry.push_back(Pair("type", GetTxnOutputType(type)));
 
-            entry.push_back(Pair("confirmations", nDepth));
-            results.push_back(entry);
+        if (fVerbose) {
+            entry.push_back(Pair("reqSigs", nRequired));
+            Array a;
+            BOOST_FOREACH(const CTxDestination& addrinner, addresses)
+                a.push_back(CBitcoinAddress(addrinner).ToString());
+            entry.push_back(Pair("addresses", a));
+
+            Object pkobj;
+            const CScript& pk = txout.scriptPubKey;
+            pkobj.push_back(Pair("asm", pk.ToString()));
+            pkobj.push_back(Pair("hex", HexStr(pk.begin(), pk.end())));
+            entry.push_back(Pair("scriptPubKey", pkobj));
+
+            const CBlockIndex* pindex = view.pindexTip->GetAncestor(nHeight);
+            entry.push_back(Pair("blockhash", pindex ? pindex->GetBlockHash().GetHex() : uint256(0).GetHex()));
+            entry.push_back(Pair("blocktime", pindex ? pindex->GetBlockTime() : 0));
+            entry.push_back(Pair("blockheight", pindex ? nHeight : 0));
         }
-        it++;
-    }
 
-    return results;
+        entry.push_back(Pair("confirmations", nDepth));
+        results.push_back(entry);
+    }
 }
 
 Value getallbalance(const Array &params, bool fHelp)
 {
-    if (fHelp || params.size() < 1 || params.size() > 3)
+    if (fHelp || params.size() < 1 || params.size() > 4)
         throw runtime_error(
-            "getallbalance \"address\" ( minconf maxreqsigs )\n"
+            "getallbalance \"address\" ( minconf maxreqsigs includemempool )\n"
 
             "\nReturns the sum of confirmed, spendable transaction outputs by address"
             " with at least minconf confirmations, whereby maximal maxreqsigs signatures"
@@ -1003,6 +1180,8 @@ Value getallbalance(const Array &params, bool fHelp)
             "1. address          (string, required) The Bitcoin address\n"
             "2. minconf          (numeric, optional, default=1) The minimum confirmations to filter\n"
             "3. maxreqsigs       (numeric, optional, default=1) The number of signatures required to spend an output\n"
+            "4. includemempool   (numeric, optional, default=0) If 1, exclude outputs spent by unconfirmed transactions,\n"
+            "                    and include unconfirmed outputs, if minconf is 0\n"
 
             "\nExamples\n"
             + HelpExampleCli("getallbalance", "1BxtgEa8UcrMzVZaW32zVyJh4Sg4KGFzxA")
@@ -1010,20 +1189,13 @@ Value getallbalance(const Array &params, bool fHelp)
             + HelpExampleRpc("getallbalance", "1BxtgEa8UcrMzVZaW32zVyJh4Sg4KGFzxA, 0, 1")
         );
 
-    RPCTypeCheck(params, list_of(str_type)(int_type)(int_type));
-
-    if (!fAddrIndex)
-        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+    RPCTypeCheck(params, list_of(str_type)(int_type)(int_type)(int_type));
 
     CBitcoinAddress address(params[0].get_str());
     if (!address.IsValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
     CTxDestination dest = address.Get();
 
-    std::set<CExtDiskTxPos> setpos;
-    if (!FindTransactionsByDestination(dest, setpos))
-        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
-
     int nMinDepth = 1;
     if (params.size() > 1)
         nMinDepth = params[1].get_int();
@@ -1032,51 +1204,211 @@ Value getallbalance(const Array &params, bool fHelp)
     if (params.size() > 2)
         nMaxReqSigs = params[2].get_int();
 
-    int64_t nBalance = 0;
-    std::set<CExtDiskTxPos>::const_iterator it = setpos.begin();
-    while (it != setpos.end()) {
-        CTransaction tx;
-        uint256 hashBlock;
-        if (!ReadTransaction(tx, *it, hashBlock))
-            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
-
-        CCoins coins;
-        pcoinsTip->GetCoins(tx.GetHash(), coins);
-        for (unsigned int i = 0; i < tx.vout.size(); i++) {
-            const CTxOut& txout = tx.vout[i];
-            if (!(coins.IsAvailable(i) && txout.nValue > 0))
-                continue;
+    bool fIncludeMempool = false;
+    if (params.size() > 3)
+        fIncludeMempool = (params[3].get_int() != 0);
+
+    // the address summary covers all confirmed outputs, which require a single signature
+    if (!fIncludeMempool && nMinDepth <= 1 && nMaxReqSigs == 1) {
+        CAddrIndexView view;
+        EnsureAddrIndex(view);
+        CAddrSummary summary;
+        if (!GetAddrSummary(view, dest, summary))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+        return ValueFromAmount(summary.GetBalance());
+    }
 
-            txnouttype type;
-            vector<CTxDestination> addresses;
-            int nRequired;
-            if (!ExtractDestinations(txout.scriptPubKey, type, addresses, nRequired))
-                continue;
-            if (nMaxReqSigs < nRequired)
-                continue;
-            if (std::find(addresses.begin(), addresses.end(), dest) == addresses.end())
-                continue;
+    CAddrUnspentReader reader(dest, fIncludeMempool);
+    int64_t nBalance = 0;
+    std::pair<COutPoint, CAddrUnspent> unspent;
+    while (reader.Next(unspent)) {
+        const CTxOut& txout = unspent.second.txout;
+        if (txout.nValue <= 0)
+            continue;
 
-            int nDepth = 0;
-            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-            if (mi != mapBlockIndex.end() && (*mi).second) {
-                CBlockIndex* pindex = (*mi).second;
-                if (chainActive.Contains(pindex)) {
-                    nDepth = chainActive.Height() - pindex->nHeight + 1;
-                }
-            }
+        int nDepth = reader.view.Height() - unspent.second.nHeight + 1;
+        if (nDepth < nMinDepth)
+            continue;
 
-            if (nDepth < nMinDepth)
-                continue;
+        txnouttype type;
+        vector<CTxDestination> addresses;
+        int nRequired;
+        if (!ExtractDestinations(txout.scriptPubKey, type, addresses, nRequired))
+            continue;
+        if (nMaxReqSigs < nRequired)
+            continue;
 
-            nBalance += txout.nValue;
-        }
-        it++;
+        nBalance += txout.nValue;
     }
 
     return ValueFromAmount(nBalance);
 }
 
+Value getaddresssummary(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresssummary \"address\"\n"
+
+            "\nReturns a summary of the confirmed transactions of an address. Values count"
+            " the outputs, which require a single signature to be spent.\n"
+
+            "\nArguments:\n"
+            "1. address          (string, required) The Bitcoin address\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"address\" : \"address\",      (string) The Bitcoin address\n"
+            "  \"balance\" : x.xxx,          (numeric) The balance in btc\n"
+            "  \"received\" : x.xxx,         (numeric) The total amount received in btc\n"
+            "  \"sent\" : x.xxx,             (numeric) The total amount sent in btc\n"
+            "  \"txcount\" : n,              (numeric) The number of transactions\n"
+            "  \"firstheight\" : n,          (numeric) The height of the first transaction, if any\n"
+            "  \"lastheight\" : n            (numeric) The height of the last transaction, if any\n"
+            "}\n"
+
+            "\nExamples\n"
+            + HelpExampleCli("getaddresssummary", "1BxtgEa8UcrMzVZaW32zVyJh4Sg4KGFzxA")
+            + HelpExampleRpc("getaddresssummary", "1BxtgEa8UcrMzVZaW32zVyJh4Sg4KGFzxA")
+        );
+
+    CBitcoinAddress address(params[0].get_str());
+    if (!address.IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
+
+    CAddrIndexView view;
+    EnsureAddrIndex(view);
+    CAddrSummary summary;
+    if (!GetAddrSummary(view, address.Get(), summary))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot search for address");
+
+    Object result;
+    result.push_back(Pair("address", address.ToString()));
+    result.push_back(Pair("balance", ValueFromAmount(summary.GetBalance())));
+    result.push_back(Pair("received", ValueFromAmount(summary.nReceived)));
+    result.push_back(Pair("sent", ValueFromAmount(summary.nSent)));
+    result.push_back(Pair("txcount", (int64_t)summary.nTxCount));
+    if (summary.nTxCount > 0) {
+        result.push_back(Pair("firstheight", summary.nFirstHeight));
+        result.push_back(Pair("lastheight", summary.nLastHeight));
+    }
+    return result;
+}
+
+Value getaddrindexinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getaddrindexinfo ( count )\n"
+
+            "\nReturns statistics about the address index, including the addresses with the most"
+            " transactions. They cover the blocks, whose changes are written to disk, which may"
+            " trail the blocks the index covers in memory. Note this call may take some time.\n"
+
+            "\nArguments:\n"
+            "1. count            (numeric, optional, default=10) The number of addresses with the most transactions to return\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"height\" : n,               (numeric) The height of the last block covered by the statistics\n"
+            "  \"bestblock\" : \"hash\",       (string) The hash of that block, if there is one\n"
+            "  \"synced\" : true|false,      (boolean) If the index has caught up with the active chain\n"
+            "  \"pushes\" : true|false,      (boolean) If data pushes are indexed, see -addrindexpushes\n"
+            "  \"addresses\" : n,            (numeric) The number of addresses\n"
+            "  \"txentries\" : n,            (numeric) The number of transaction entries\n"
+            "  \"unspententries\" : n,       (numeric) The number of unspent output entries\n"
+            "  \"txentries_bytes\" : n,      (numeric) The approximate size on disk of the transaction entries\n"
+            "  \"unspententries_bytes\" : n, (numeric) The approximate size on disk of the unspent output entries\n"
+            "  \"summaries_bytes\" : n,      (numeric) The approximate size on disk of the address summaries\n"
+            "  \"top\" : [                   (array of json objects) The addresses with the most transactions\n"
+            "    {\n"
+            "      \"id\" : \"hex\",           (string) The key or script hash of the address\n"
+            "      \"txcount\" : n,          (numeric) The number of transactions\n"
+            "      \"received\" : x.xxx,     (numeric) The total amount received in btc\n"
+            "      \"sent\" : x.xxx          (numeric) The total amount sent in btc\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+
+            "\nExamples\n"
+            + HelpExampleCli("getaddrindexinfo", "")
+            + HelpExampleCli("getaddrindexinfo", "100")
+            + HelpExampleRpc("getaddrindexinfo", "100")
+        );
+
+    RPCTypeCheck(params, list_of(int_type));
+
+    int nTop = 10;
+    if (params.size() > 0)
+        nTop = params[0].get_int();
+    if (nTop < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    // The statistics are read from a view, which is also taken while the index is syncing.
+    CAddrIndexView view;
+    bool fSynced;
+    {
+        LOCK(cs_main);
+        if (!GetAddrIndexView(view))
+            throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+        fSynced = (view.pindexTip == chainActive.Tip());
+    }
+    CAddrIndexStats stats;
+    if (!paddrindex->GetAddrIndexStats(stats, nTop, view.psnapshot.get()))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot read address index");
+
+    Object result;
+    result.push_back(Pair("height", view.pindexWritten ? view.pindexWritten->nHeight : -1));
+    if (view.pindexWritten)
+        result.push_back(Pair("bestblock", view.pindexWritten->GetBlockHash().GetHex()));
+    result.push_back(Pair("synced", fSynced));
+    result.push_back(Pair("pushes", fAddrIndexPushes));
+    result.push_back(Pair("addresses", (int64_t)stats.nAddresses));
+    result.push_back(Pair("txentries", (int64_t)stats.nHistoryEntries));
+    result.push_back(Pair("unspententries", (int64_t)stats.nUnspentEntries));
+    result.push_back(Pair("txentries_bytes", (int64_t)stats.nHistorySize));
+    result.push_back(Pair("unspententries_bytes", (int64_t)stats.nUnspentSize));
+    result.push_back(Pair("summaries_bytes", (int64_t)stats.nSummarySize));
+    Array top;
+    std::vector<std::pair<uint160, CAddrSummary> >::const_iterator it = stats.vTop.begin();
+    for (; it != stats.vTop.end(); it++) {
+        Object entry;
+        entry.push_back(Pair("id", HexStr(it->first.begin(), it->first.end())));
+        entry.push_back(Pair("txcount", (int64_t)it->second.nTxCount));
+        entry.push_back(Pair("received", ValueFromAmount(it->second.nReceived)));
+        entry.push_back(Pair("sent", ValueFromAmount(it->second.nSent)));
+        top.push_back(entry);
+    }
+    result.push_back(Pair("top", top));
+    return result;
+}
+
+Value compactaddrindex(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "compactaddrindex\n"
+
+            "\nCompacts the address index on disk, which otherwise happens in the background, when"
+            " blocks are connected. Reads and writes of the index are slower meanwhile. Note this"
+            " call may take some time.\n"
+
+            "\nExamples\n"
+            + HelpExampleCli("compactaddrindex", "")
+            + HelpExampleRpc("compactaddrindex", "")
+        );
+
+    {
+        LOCK(cs_main);
+        if (!fAddrIndex)
+            throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled");
+    }
+    int64_t nStart = GetTimeMillis();
+    paddrindex->CompactAddrIndex();
+    LogPrintf("compactaddrindex: compacted address index in %dms\n", GetTimeMillis() - nStart);
+    return Value::null;
+}
+
 Value gettxposition(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
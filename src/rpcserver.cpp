@@ -263,11 +263,12 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getblock",               &getblock,               true,      false,      false },
     { "blockchain",         "getblockhash",           &getblockhash,           true,      false,      false },
     { "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false },
+    { "blockchain",         "getcoincacheinfo",       &getcoincacheinfo,       true,      false,      false },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
     { "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      true,       false },
     { "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
     { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
     { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
@@ -307,9 +308,12 @@ static const CRPCCommand vRPCCommands[] =
     { "hidden",             "setmocktime",            &setmocktime,            true,      false,      false },
 
     /* Address index extensions */
-    { "address index",      "searchrawtransactions",  &searchrawtransactions,  false,     false,      false },
-    { "address index",      "listallunspent",         &listallunspent,         false,     false,      false },
-    { "address index",      "getallbalance",          &getallbalance,          false,     false,      false },
+    { "address index",      "searchrawtransactions",  &RPCCollectArray<searchrawtransactions>, false, true, false },
+    { "address index",      "listallunspent",         &RPCCollectArray<listallunspent>, false,  true,       false },
+    { "address index",      "getallbalance",          &getallbalance,          false,     true,       false },
+    { "address index",      "getaddresssummary",      &getaddresssummary,      false,     true,       false },
+    { "address index",      "getaddrindexinfo",       &getaddrindexinfo,       false,     true,       false },
+    { "address index",      "compactaddrindex",       &compactaddrindex,       false,     true,       false },
     { "address index",      "gettxposition",          &gettxposition,          false,     false,      false },
 
 #ifdef ENABLE_WALLET
@@ -356,6 +360,17 @@ static const CRPCCommand vRPCCommands[] =
 #endif // ENABLE_WALLET
 };
 
+/**
+ * Methods, which can hand out their array results element by element, so that large
+ * results are written to HTTP/1.1 clients while they are produced
+ */
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      actor (function)
+  //  ------------------------  -----------------------
+    { "searchrawtransactions",  &searchrawtransactions },
+    { "listallunspent",         &listallunspent },
+};
+
 CRPCTable::CRPCTable()
 {
     unsigned int vcidx;
@@ -366,6 +381,8 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+        mapStreamCommands[vRPCStreamCommands[vcidx].name] = vRPCStreamCommands[vcidx].actor;
 }
 
 const CRPCCommand *CRPCTable::operator[](string name) const
@@ -485,7 +502,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
                    const bool fUseSSL)
 {
     // Accept connection
-    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL));
+    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(GetIOService(*acceptor), context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -597,7 +614,7 @@ void StartRPCThreads()
 
     assert(rpc_io_service == NULL);
     rpc_io_service = new asio::io_service();
-    rpc_ssl_context = new ssl::context(*rpc_io_service, ssl::context::sslv23);
+    rpc_ssl_context = new ssl::context(ssl::context::sslv23);
 
     const bool fUseSSL = GetBoolArg("-rpcssl", false);
 
@@ -616,7 +633,7 @@ void StartRPCThreads()
         else LogPrintf("ThreadRPCServer ERROR: missing server private key file %s\n", pathPKFile.string());
 
         string strCiphers = GetArg("-rpcsslciphers", "TLSv1.2+HIGH:TLSv1+HIGH:!SSLv2:!aNULL:!eNULL:!3DES:@STRENGTH");
-        SSL_CTX_set_cipher_list(rpc_ssl_context->impl(), strCiphers.c_str());
+        SSL_CTX_set_cipher_list(rpc_ssl_context->native_handle(), strCiphers.c_str());
     }
 
     std::vector<ip::tcp::endpoint> vEndpoints;
@@ -872,9 +889,64 @@ static string JSONRPCExecBatch(const Array& vReq)
     return write_string(Value(ret), false) + "\n";
 }
 
+/** Size of the chunks, in which streamed results are written */
+static const size_t STREAM_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Writes a JSON-RPC reply with an array result to the connection, with chunked transfer
+ * encoding, while the elements are produced. Nothing is written before the first chunk
+ * is full, so errors of methods, which fail early, are still replied as usual.
+ */
+class HTTPStreamReply : public CRPCArrayWriter
+{
+private:
+    std::ostream& stream;
+    bool fKeepAlive;
+    Value id;
+    string strChunk;
+    bool fStarted;
+    bool fEmpty;
+
+    void WriteChunk()
+    {
+        if (!fStarted)
+            stream << HTTPReplyHeaderChunked(HTTP_OK, fKeepAlive);
+        fStarted = true;
+        stream << strprintf("%x\r\n", strChunk.size()) << strChunk << "\r\n";
+        strChunk.clear();
+        if (!stream)
+            throw runtime_error("connection lost");
+    }
+
+public:
+    HTTPStreamReply(std::ostream& streamIn, bool fKeepAliveIn, const Value& idIn) :
+        stream(streamIn), fKeepAlive(fKeepAliveIn), id(idIn), strChunk("{\"result\":["), fStarted(false), fEmpty(true) {}
+
+    /** Whether the reply has begun, after which an error can only be signaled by closing the connection */
+    bool IsStarted() const { return fStarted; }
+
+    void push_back(const Value& value)
+    {
+        if (!fEmpty)
+            strChunk += ",";
+        fEmpty = false;
+        strChunk += write_string(value, false);
+        if (strChunk.size() >= STREAM_CHUNK_SIZE)
+            WriteChunk();
+    }
+
+    void Finish()
+    {
+        strChunk += "],\"error\":null,\"id\":" + write_string(id, false) + "}\n";
+        WriteChunk();
+        stream << "0\r\n\r\n" << std::flush;
+    }
+};
+
 static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
                             string& strRequest,
                             map<string, string>& mapHeaders,
+                            int nProto,
                             bool fRun)
 {
     // Check authorization
@@ -917,6 +989,23 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
         if (valRequest.type() == obj_type) {
             jreq.parse(valRequest);
 
+            // Stream large array results to HTTP/1.1 clients, which understand chunked replies
+            if (nProto >= 1) {
+                HTTPStreamReply reply(conn->stream(), fRun, jreq.id);
+                try {
+                    if (tableRPC.executeStream(jreq.strMethod, jreq.params, reply)) {
+                        reply.Finish();
+                        return true;
+                    }
+                } catch (...) {
+                    if (reply.IsStarted()) {
+                        LogPrintf("ThreadRPCServer %s failed while streaming its reply\n", SanitizeString(jreq.strMethod));
+                        return false;
+                    }
+                    throw;
+                }
+            }
+
             Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -965,7 +1054,7 @@ void ServiceConnection(AcceptedConnection *conn)
 
         // Process via JSON-RPC API
         if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
+            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, nProto, fRun))
                 break;
 
         // Process via HTTP REST API
@@ -980,7 +1069,7 @@ void ServiceConnection(AcceptedConnection *conn)
     }
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+const CRPCCommand* CRPCTable::checkCommand(const std::string &strMethod) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -997,6 +1086,13 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = checkCommand(strMethod);
+
     try
     {
         // Execute
@@ -1027,6 +1123,56 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     }
 }
 
+bool CRPCTable::executeStream(const std::string &strMethod, const json_spirit::Array &params, CRPCArrayWriter &writer) const
+{
+    map<string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+    if (it == mapStreamCommands.end())
+        return false;
+    const CRPCCommand *pcmd = checkCommand(strMethod);
+    rpcstreamfn_type actor = it->second;
+
+    try
+    {
+        // Only methods, which take their locks themselves, write while they run, as a slow
+        // client must not stall the node. Others are run with the same locks as execute(),
+        // and their result is written after the locks are released.
+        if (pcmd->threadSafe) {
+            actor(params, false, writer);
+            return true;
+        }
+        CRPCArrayCollector result;
+#ifdef ENABLE_WALLET
+        if (!pwalletMain) {
+            LOCK(cs_main);
+            actor(params, false, result);
+        } else {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            actor(params, false, result);
+        }
+#else // ENABLE_WALLET
+        {
+            LOCK(cs_main);
+            actor(params, false, result);
+        }
+#endif // !ENABLE_WALLET
+        BOOST_FOREACH(const Value& value, result.array)
+            writer.push_back(value);
+        return true;
+    }
+    catch (Object&)
+    {
+        throw;
+    }
+    catch (std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+    catch (...)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, "unknown error");
+    }
+}
+
 std::string HelpExampleCli(string methodname, string args){
     return "> bitcoin-cli " + methodname + " " + args + "\n";
 }
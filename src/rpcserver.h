@@ -92,6 +92,44 @@ public:
     bool reqWallet;
 };
 
+/**
+ * Receiver of the elements of an array result, so that methods with large results can hand
+ * out the elements while they are produced, instead of building the whole array first.
+ */
+class CRPCArrayWriter
+{
+public:
+    virtual ~CRPCArrayWriter() {}
+    virtual void push_back(const json_spirit::Value& value) = 0;
+};
+
+/** Array writer, which collects the elements in memory */
+class CRPCArrayCollector : public CRPCArrayWriter
+{
+public:
+    json_spirit::Array array;
+
+    void push_back(const json_spirit::Value& value) { array.push_back(value); }
+};
+
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp, CRPCArrayWriter& result);
+
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type actor;
+};
+
+/** Adapter, which runs a streaming method as a regular one, with its result collected in memory */
+template<rpcstreamfn_type actor>
+json_spirit::Value RPCCollectArray(const json_spirit::Array& params, bool fHelp)
+{
+    CRPCArrayCollector result;
+    actor(params, fHelp, result);
+    return result.array;
+}
+
 /**
  * Bitcoin RPC command dispatcher.
  */
@@ -99,6 +137,9 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
+
+    const CRPCCommand* checkCommand(const std::string &method) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
@@ -112,6 +153,13 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method, whose array result is handed to writer element by element.
+     * @returns false, without executing anything, if the method cannot stream its result.
+     * @throws an exception (json_spirit::Value) when an error happens.
+     */
+    bool executeStream(const std::string &method, const json_spirit::Array &params, CRPCArrayWriter &writer) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -215,6 +263,7 @@ extern json_spirit::Value getbestblockhash(const json_spirit::Array& params, boo
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getcoincacheinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
@@ -226,9 +275,12 @@ extern json_spirit::Value invalidateblock(const json_spirit::Array& params, bool
 extern json_spirit::Value reconsiderblock(const json_spirit::Array& params, bool fHelp);
 
 // Address index extensions
-extern json_spirit::Value searchrawtransactions(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
-extern json_spirit::Value listallunspent(const json_spirit::Array& params, bool fHelp);
+extern void searchrawtransactions(const json_spirit::Array& params, bool fHelp, CRPCArrayWriter& result); // in rcprawtransaction.cpp
+extern void listallunspent(const json_spirit::Array& params, bool fHelp, CRPCArrayWriter& result);
 extern json_spirit::Value getallbalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddresssummary(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddrindexinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value compactaddrindex(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxposition(const json_spirit::Array& params, bool fHelp);
 
 // in rest.cpp
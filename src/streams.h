@@ -306,6 +306,56 @@ public:
 
 
 
+/** Stream subset for deserializing from memory that is owned elsewhere, such as a mapped file,
+ * without copying it into a buffer first. The memory must outlive the reader.
+ */
+class CMemoryReader
+{
+private:
+    int nType;
+    int nVersion;
+
+    const char* pbegin;
+    const char* pend;
+
+public:
+    CMemoryReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) :
+        nType(nTypeIn), nVersion(nVersionIn), pbegin(pbeginIn), pend(pendIn) {}
+
+    size_t size() const          { return pend - pbegin; }
+
+    //
+    // Stream subset
+    //
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
+    CMemoryReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::read : end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+        return (*this);
+    }
+
+    CMemoryReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::ignore : end of data");
+        pbegin += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CMemoryReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 /** Non-refcounted RAII wrapper for FILE*
  *
  * Will automatically close the file when it goes out of scope if not null.
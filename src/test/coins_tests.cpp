@@ -4,11 +4,13 @@
 
 #include "coins.h"
 #include "random.h"
+#include "script/script.h"
 #include "uint256.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -58,6 +60,22 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -89,8 +107,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -115,6 +133,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 coins.nVersion = insecure_rand();
                 coins.vout.resize(1);
                 coins.vout[0].nValue = insecure_rand();
+                coins.vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(insecure_rand() % 64, 0);
                 *entry = coins;
             } else {
                 coins.Clear();
@@ -135,12 +154,16 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
+                test->SelfTest();
+            }
         }
 
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
                 stack.back()->Flush();
+                stack.back()->SelfTest();
                 delete stack.back();
                 stack.pop_back();
             }
@@ -151,7 +174,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +198,34 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_fetched_entries)
+{
+    CCoinsViewTest base;
+    uint256 txidBase = GetRandHash(), txidModified = GetRandHash();
+    {
+        CCoinsViewCache setup(&base);
+        setup.ModifyCoins(txidBase)->vout.push_back(CTxOut(1000, CScript()));
+        setup.ModifyCoins(txidModified)->vout.push_back(CTxOut(2000, CScript()));
+        setup.SetBestBlock(GetRandHash());
+        BOOST_CHECK(setup.Flush());
+    }
+
+    CCoinsViewCache cache(&base);
+    BOOST_CHECK(!cache.HaveCoinsInCache(txidBase));
+    BOOST_CHECK(cache.GetBackend() == &base);
+
+    // Coins read ahead of time are cached like those fetched on demand
+    CCoins coins;
+    BOOST_CHECK(cache.GetBackend()->GetCoins(txidBase, coins));
+    cache.AddFetchedCoins(txidBase, coins);
+    BOOST_CHECK(cache.HaveCoinsInCache(txidBase));
+    BOOST_CHECK(cache.AccessCoins(txidBase)->vout[0].nValue == 1000);
+
+    // but do not replace entries of the cache
+    cache.ModifyCoins(txidModified)->vout[0].nValue = 3000;
+    BOOST_CHECK(cache.GetBackend()->GetCoins(txidModified, coins));
+    cache.AddFetchedCoins(txidModified, coins);
+    BOOST_CHECK(cache.AccessCoins(txidModified)->vout[0].nValue == 3000);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
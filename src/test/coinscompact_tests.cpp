@@ -0,0 +1,161 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinscompact.h"
+#include "random.h"
+#include "script/script.h"
+#include "uint256.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** Base view, which counts its reads */
+class CCoinsViewCounting : public CCoinsView
+{
+public:
+    std::map<uint256, CCoins> mapCoins;
+    mutable int nReads;
+
+    CCoinsViewCounting() : nReads(0) {}
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const
+    {
+        nReads++;
+        std::map<uint256, CCoins>::const_iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+
+    bool BatchWrite(CCoinsMap &mapWrite, const uint256 &hashBlock)
+    {
+        for (CCoinsMap::iterator it = mapWrite.begin(); it != mapWrite.end(); ++it) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY)
+                mapCoins[it->first] = it->second.coins;
+        }
+        mapWrite.clear();
+        return true;
+    }
+};
+}
+
+static CCoins MakeCoins(CAmount nValue, int nOutputs)
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 100;
+    for (int i = 0; i < nOutputs; i++)
+        coins.vout.push_back(CTxOut(nValue + i, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG));
+    return coins;
+}
+
+BOOST_AUTO_TEST_SUITE(coinscompact_tests)
+
+BOOST_AUTO_TEST_CASE(coinscompact_map)
+{
+    CCoinsCompactMap map(1 << 20);
+    std::vector<uint256> vTxid;
+    for (int i = 0; i < 1000; i++) {
+        vTxid.push_back(GetRandHash());
+        map.Put(vTxid.back(), MakeCoins(i, 1 + i % 3));
+    }
+    BOOST_CHECK_EQUAL(map.GetCount(), 1000U);
+    for (int i = 0; i < 1000; i++) {
+        CCoins coins;
+        BOOST_CHECK(map.Get(vTxid[i], coins));
+        BOOST_CHECK(coins == MakeCoins(i, 1 + i % 3));
+    }
+    BOOST_CHECK(!map.Have(GetRandHash()));
+
+    // replaced coins are found in their new state, and spent ones are erased
+    CCoins coins = MakeCoins(7, 2);
+    coins.vout[0].SetNull();
+    map.Put(vTxid[7], coins);
+    CCoins coinsRead;
+    BOOST_CHECK(map.Get(vTxid[7], coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+    coins.vout[1].SetNull();
+    map.Put(vTxid[7], coins);
+    BOOST_CHECK(!map.Have(vTxid[7]));
+    map.Erase(vTxid[8]);
+    BOOST_CHECK(!map.Get(vTxid[8], coinsRead));
+    BOOST_CHECK_EQUAL(map.GetCount(), 998U);
+
+    map.Clear();
+    BOOST_CHECK_EQUAL(map.GetCount(), 0U);
+    BOOST_CHECK(!map.Have(vTxid[0]));
+}
+
+BOOST_AUTO_TEST_CASE(coinscompact_map_size)
+{
+    // the map stays within its size, and keeps the entries added last
+    size_t nMaxSize = 1 << 18;
+    CCoinsCompactMap map(nMaxSize);
+    std::vector<uint256> vTxid;
+    for (int i = 0; i < 20000; i++) {
+        vTxid.push_back(GetRandHash());
+        map.Put(vTxid.back(), MakeCoins(i, 2));
+        BOOST_CHECK(map.DynamicMemoryUsage() <= nMaxSize);
+    }
+    BOOST_CHECK(map.GetCount() > 100U && map.GetCount() < 20000U);
+    for (int i = 19900; i < 20000; i++) {
+        CCoins coins;
+        BOOST_CHECK(map.Get(vTxid[i], coins));
+        BOOST_CHECK(coins == MakeCoins(i, 2));
+    }
+    BOOST_CHECK(!map.Have(vTxid[0]));
+
+    // replacing entries over and over again leaves garbage, which is dropped
+    for (int i = 0; i < 20000; i++) {
+        map.Put(vTxid[19999], MakeCoins(i, 2));
+        BOOST_CHECK(map.DynamicMemoryUsage() <= nMaxSize);
+    }
+    CCoins coins;
+    BOOST_CHECK(map.Get(vTxid[19999], coins));
+    BOOST_CHECK(coins == MakeCoins(19999, 2));
+    BOOST_CHECK(map.Have(vTxid[19998]));
+}
+
+BOOST_AUTO_TEST_CASE(coinscompact_view)
+{
+    CCoinsViewCounting base;
+    CCoinsViewCompact compact(&base, 1 << 20);
+    uint256 txidRead = GetRandHash(), txidNew = GetRandHash();
+    base.mapCoins[txidRead] = MakeCoins(1000, 1);
+
+    // coins read by the cache above, and those it creates, are kept after it is flushed
+    {
+        CCoinsViewCache cache(&compact);
+        BOOST_CHECK(cache.HaveCoins(txidRead));
+        *cache.ModifyCoins(txidNew) = MakeCoins(2000, 2);
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(compact.GetCount(), 2U);
+    BOOST_CHECK(base.mapCoins[txidNew] == MakeCoins(2000, 2));
+    int nReads = base.nReads;
+    CCoins coins;
+    BOOST_CHECK(compact.GetCoins(txidRead, coins));
+    BOOST_CHECK(coins == MakeCoins(1000, 1));
+    BOOST_CHECK(compact.GetCoins(txidNew, coins));
+    BOOST_CHECK(coins == MakeCoins(2000, 2));
+    BOOST_CHECK_EQUAL(base.nReads, nReads);
+
+    // spending all outputs erases the coins
+    {
+        CCoinsViewCache cache(&compact);
+        cache.ModifyCoins(txidRead)->vout[0].SetNull();
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(compact.GetCount(), 1U);
+    BOOST_CHECK(base.mapCoins[txidRead].IsPruned());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,61 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lrumap.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(lrumap_tests)
+
+BOOST_AUTO_TEST_CASE(lrumap_evicts_least_recently_used)
+{
+    lrumap<int, int> lru(3);
+    lru.insert(1, 10);
+    lru.insert(2, 20);
+    lru.insert(3, 30);
+    BOOST_CHECK_EQUAL(lru.size(), 3U);
+
+    // using 1 makes 2 the least recently used element
+    BOOST_CHECK(lru.get(1) != NULL);
+    BOOST_CHECK_EQUAL(*lru.get(1), 10);
+    lru.insert(4, 40);
+    BOOST_CHECK_EQUAL(lru.size(), 3U);
+    BOOST_CHECK(lru.get(2) == NULL);
+    BOOST_CHECK(lru.count(1) && lru.count(3) && lru.count(4));
+
+    // replacing a value makes it the most recently used one
+    lru.insert(3, 31);
+    lru.insert(5, 50);
+    BOOST_CHECK(lru.get(1) == NULL);
+    BOOST_CHECK_EQUAL(*lru.get(3), 31);
+
+    lru.erase(3);
+    BOOST_CHECK_EQUAL(lru.size(), 2U);
+    BOOST_CHECK(lru.get(3) == NULL);
+    lru.clear();
+    BOOST_CHECK(lru.empty());
+}
+
+BOOST_AUTO_TEST_CASE(lrumap_cost)
+{
+    lrumap<int, int> lru(100);
+    lru.insert(1, 10, 40);
+    lru.insert(2, 20, 40);
+    BOOST_CHECK_EQUAL(lru.cost(), 80U);
+
+    // evicts as many elements as needed to stay within the maximal cost
+    lru.insert(3, 30, 90);
+    BOOST_CHECK_EQUAL(lru.size(), 1U);
+    BOOST_CHECK_EQUAL(lru.cost(), 90U);
+
+    // an element above the maximal cost is not kept
+    lru.insert(4, 40, 101);
+    BOOST_CHECK(lru.get(4) == NULL);
+    BOOST_CHECK(lru.get(3) != NULL);
+
+    lru.erase(3);
+    BOOST_CHECK_EQUAL(lru.cost(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,10 @@
 
 #include "primitives/transaction.h"
 #include "main.h"
+#include "key.h"
+#include "pubkey.h"
+#include "script/standard.h"
+#include "txdb.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -21,4 +25,106 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 2099999997690000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(addrindex_extract_ids)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint160 keyid = static_cast<uint160>(pubkey.GetID());
+    std::vector<unsigned char> vchData(40, 0x42);
+    CScript redeem = CScript() << OP_1 << ToByteVector(pubkey) << OP_1 << OP_CHECKMULTISIG;
+    CScript nonstandard = CScript() << vchData << OP_DROP << OP_TRUE;
+
+    bool fPushesOld = fAddrIndexPushes;
+    std::vector<uint160> vAddrId;
+
+    // only key and script ids of standard scripts are indexed by default
+    fAddrIndexPushes = false;
+    ExtractAddrIndexIds(GetScriptForDestination(pubkey.GetID()), vAddrId);
+    BOOST_CHECK(vAddrId.size() == 1 && vAddrId[0] == keyid);
+    vAddrId.clear();
+    ExtractAddrIndexIds(CScript() << ToByteVector(pubkey) << OP_CHECKSIG, vAddrId);
+    BOOST_CHECK(vAddrId.size() == 1 && vAddrId[0] == keyid);
+    vAddrId.clear();
+    ExtractAddrIndexIds(GetScriptForDestination(CScriptID(redeem)), vAddrId);
+    BOOST_CHECK(vAddrId.size() == 1 && vAddrId[0] == static_cast<uint160>(CScriptID(redeem)));
+    vAddrId.clear();
+    ExtractAddrIndexIds(redeem, vAddrId);
+    BOOST_CHECK(vAddrId.size() == 1 && vAddrId[0] == keyid);
+    vAddrId.clear();
+    ExtractAddrIndexIds(CScript() << OP_RETURN << vchData, vAddrId);
+    ExtractAddrIndexIds(nonstandard, vAddrId);
+    BOOST_CHECK(vAddrId.empty());
+
+    // data pushes are added, and scripts without any are indexed by their hash
+    fAddrIndexPushes = true;
+    ExtractAddrIndexIds(GetScriptForDestination(pubkey.GetID()), vAddrId);
+    BOOST_CHECK(vAddrId.size() == 1 && vAddrId[0] == keyid);
+    vAddrId.clear();
+    ExtractAddrIndexIds(nonstandard, vAddrId);
+    BOOST_CHECK(vAddrId.size() == 1 && vAddrId[0] == Hash160(vchData));
+    vAddrId.clear();
+    CScript noData = CScript() << OP_TRUE;
+    ExtractAddrIndexIds(noData, vAddrId);
+    BOOST_CHECK(vAddrId.size() == 1 && vAddrId[0] == Hash160(noData));
+
+    fAddrIndexPushes = fPushesOld;
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_unspent_update)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    uint160 keyid = static_cast<uint160>(key.GetPubKey().GetID());
+    CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // A block, whose second transaction spends an output of an earlier one, which has more unspent outputs
+    uint256 hashPrev(1);
+    CTxOut txoutPrev(5000, script);
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.push_back(CTxOut(2500, CScript() << OP_TRUE));
+    CMutableTransaction spend;
+    spend.vin.push_back(CTxIn(COutPoint(hashPrev, 0)));
+    spend.vout.push_back(CTxOut(4000, script));
+    CBlock block;
+    block.vtx.push_back(coinbase);
+    block.vtx.push_back(spend);
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(txoutPrev));
+    CBlockIndex index;
+    index.nHeight = 10;
+
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    {
+        CCoinsModifier coins = view.ModifyCoins(hashPrev);
+        coins->nHeight = 5;
+        coins->vout.resize(2);
+        coins->vout[1] = CTxOut(1000, CScript() << OP_TRUE);
+    }
+
+    // Connecting adds the new output and removes the spent one
+    CAddrIndexUpdate update;
+    BuildAddrIndexUpdate(block, blockundo, &index, false, view, update);
+    BOOST_CHECK_EQUAL(update.vUnspentAdd.size(), 1U);
+    BOOST_CHECK(update.vUnspentAdd[0].first.first == keyid);
+    BOOST_CHECK(update.vUnspentAdd[0].first.second == COutPoint(block.vtx[1].GetHash(), 0));
+    BOOST_CHECK_EQUAL(update.vUnspentAdd[0].second.nHeight, 10);
+    BOOST_CHECK_EQUAL(update.vUnspentAdd[0].second.txout.nValue, 4000);
+    BOOST_CHECK_EQUAL(update.vUnspentErase.size(), 1U);
+    BOOST_CHECK(update.vUnspentErase[0] == std::make_pair(keyid, COutPoint(hashPrev, 0)));
+
+    // Disconnecting restores the spent output, with its height from the view, and removes the new one
+    CAddrIndexUpdate revert;
+    BuildAddrIndexUpdate(block, blockundo, &index, true, view, revert);
+    BOOST_CHECK_EQUAL(revert.vUnspentAdd.size(), 1U);
+    BOOST_CHECK(revert.vUnspentAdd[0].first == std::make_pair(keyid, COutPoint(hashPrev, 0)));
+    BOOST_CHECK_EQUAL(revert.vUnspentAdd[0].second.nHeight, 5);
+    BOOST_CHECK_EQUAL(revert.vUnspentAdd[0].second.txout.nValue, 5000);
+    BOOST_CHECK_EQUAL(revert.vUnspentErase.size(), 1U);
+    BOOST_CHECK(revert.vUnspentErase[0] == std::make_pair(keyid, COutPoint(block.vtx[1].GetHash(), 0)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -99,4 +99,60 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAddrIndexTest)
+{
+    // Test the address index of CTxMemPool
+    uint160 addrid(1);
+    uint160 addridOther(2);
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 33000LL;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000LL;
+
+    CTxMemPool testPool(CFeeRate(0));
+    std::vector<uint160> vAddrIdParent;
+    vAddrIdParent.push_back(addrid);
+    vAddrIdParent.push_back(addrid);
+    vAddrIdParent.push_back(addridOther);
+    std::vector<uint160> vAddrIdChild(1, addrid);
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1), vAddrIdParent);
+    testPool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 0, 0, 0.0, 1), vAddrIdChild);
+
+    std::vector<uint256> vtxid;
+    testPool.queryHashesByAddr(addrid, vtxid);
+    BOOST_CHECK_EQUAL(vtxid.size(), 2);
+    vtxid.clear();
+    testPool.queryHashesByAddr(addridOther, vtxid);
+    BOOST_CHECK_EQUAL(vtxid.size(), 1);
+    BOOST_CHECK(vtxid[0] == txParent.GetHash());
+
+    // Removing the parent for a block also removes its entries
+    std::vector<CTransaction> vtx(1, txParent);
+    std::list<CTransaction> conflicts;
+    testPool.removeForBlock(vtx, 2, conflicts);
+    vtxid.clear();
+    testPool.queryHashesByAddr(addrid, vtxid);
+    BOOST_CHECK_EQUAL(vtxid.size(), 1);
+    BOOST_CHECK(vtxid[0] == txChild.GetHash());
+    vtxid.clear();
+    testPool.queryHashesByAddr(addridOther, vtxid);
+    BOOST_CHECK_EQUAL(vtxid.size(), 0);
+
+    testPool.clear();
+    vtxid.clear();
+    testPool.queryHashesByAddr(addrid, vtxid);
+    BOOST_CHECK_EQUAL(vtxid.size(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
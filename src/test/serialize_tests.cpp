@@ -161,4 +161,27 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(memory_reader)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << (uint32_t)42 << std::string("mapped") << (uint64_t)7;
+    std::vector<char> vch(ss.begin(), ss.end());
+
+    CMemoryReader reader(&vch[0], &vch[0] + vch.size(), SER_DISK, 0);
+    uint32_t n;
+    std::string str;
+    reader >> n >> str;
+    BOOST_CHECK_EQUAL(n, 42U);
+    BOOST_CHECK_EQUAL(str, "mapped");
+    BOOST_CHECK_EQUAL(reader.size(), 8U);
+
+    // reading or skipping past the end throws, and leaves the reader where it was
+    BOOST_CHECK_THROW(reader.ignore(9), std::ios_base::failure);
+    reader.ignore(4);
+    BOOST_CHECK_EQUAL(reader.size(), 4U);
+    reader >> n;
+    BOOST_CHECK_EQUAL(reader.size(), 0U);
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
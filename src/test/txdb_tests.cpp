@@ -0,0 +1,623 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+
+#include "random.h"
+#include "script/script.h"
+
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(txdb_tests)
+
+static CExtDiskTxPos MakePos(int nFile, unsigned int nPos, unsigned int nTxOffset, int nHeight)
+{
+    return CExtDiskTxPos(CDiskTxPos(CDiskBlockPos(nFile, nPos), nTxOffset), nHeight);
+}
+
+//! Read all unspent outputs of addrid
+static bool ReadUnspent(CAddrIndexDB &db, const uint160 &addrid, std::vector<std::pair<COutPoint, CAddrUnspent> > &vUnspent,
+                        const CLevelDBSnapshot *psnapshot = NULL)
+{
+    return db.ReadAddrUnspentIndex(addrid, vUnspent, 0, NULL, std::numeric_limits<size_t>::max(), psnapshot);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_order_and_range)
+{
+    CAddrIndexDB db(1 << 20, true);
+    uint160 addrid(1);
+    uint160 addridOther(2);
+
+    // Insert out of order, with positions that would not sort by height
+    // in the variable-length encoding
+    CAddrIndexUpdate update;
+    std::vector<std::pair<uint160, CExtDiskTxPos> > &vAdd = update.vPosAddrid;
+    vAdd.push_back(std::make_pair(addrid, MakePos(1, 200, 81, 300)));
+    vAdd.push_back(std::make_pair(addrid, MakePos(0, 100000, 81, 2)));
+    vAdd.push_back(std::make_pair(addrid, MakePos(0, 8, 81, 1)));
+    vAdd.push_back(std::make_pair(addrid, MakePos(1, 200, 300, 300)));
+    vAdd.push_back(std::make_pair(addrid, MakePos(0, 128, 81, 129)));
+    vAdd.push_back(std::make_pair(addridOther, MakePos(0, 50, 81, 5)));
+    BOOST_CHECK(db.WriteAddrIndex(update, uint256(1)));
+
+    std::vector<CExtDiskTxPos> vpos;
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 5U);
+    for (unsigned int i = 1; i < vpos.size(); i++)
+        BOOST_CHECK(vpos[i-1] < vpos[i]);
+    BOOST_CHECK(vpos[0] == MakePos(0, 8, 81, 1));
+    BOOST_CHECK(vpos[4] == MakePos(1, 200, 300, 300));
+
+    // Height range
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos, 2, 129));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == MakePos(0, 100000, 81, 2));
+    BOOST_CHECK(vpos[1] == MakePos(0, 128, 81, 129));
+
+    // Skip and limit
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos, 0, std::numeric_limits<int>::max(), 1, 2));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == MakePos(0, 100000, 81, 2));
+    BOOST_CHECK(vpos[1] == MakePos(0, 128, 81, 129));
+
+    // Reverse, newest first
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos, 0, 299, 0, 2, true));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == MakePos(0, 128, 81, 129));
+    BOOST_CHECK(vpos[1] == MakePos(0, 100000, 81, 2));
+
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos, 0, std::numeric_limits<int>::max(), 1, 1, true));
+    BOOST_CHECK_EQUAL(vpos.size(), 1U);
+    BOOST_CHECK(vpos[0] == MakePos(1, 200, 81, 300));
+
+    // Reverting entries erases them
+    CAddrIndexUpdate revert;
+    revert.vPosAddrid.assign(vAdd.begin(), vAdd.begin() + 2);
+    BOOST_CHECK(db.WriteAddrIndex(revert, uint256(0), true));
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 3U);
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addridOther, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_merged_addresses)
+{
+    CAddrIndexDB db(1 << 20, true);
+    std::vector<uint160> vAddrId;
+    vAddrId.push_back(uint160(1));
+    vAddrId.push_back(uint160(2));
+
+    // A transaction touching both addresses is listed once
+    CAddrIndexUpdate update;
+    std::vector<std::pair<uint160, CExtDiskTxPos> > &vAdd = update.vPosAddrid;
+    vAdd.push_back(std::make_pair(vAddrId[0], MakePos(0, 8, 81, 1)));
+    vAdd.push_back(std::make_pair(vAddrId[1], MakePos(0, 8, 200, 1)));
+    vAdd.push_back(std::make_pair(vAddrId[0], MakePos(0, 500, 81, 3)));
+    vAdd.push_back(std::make_pair(vAddrId[1], MakePos(0, 500, 81, 3)));
+    vAdd.push_back(std::make_pair(vAddrId[1], MakePos(0, 900, 81, 4)));
+    vAdd.push_back(std::make_pair(uint160(3), MakePos(0, 300, 81, 2)));
+    BOOST_CHECK(db.WriteAddrIndex(update, uint256(4)));
+
+    std::vector<CExtDiskTxPos> vpos;
+    BOOST_CHECK(db.ReadAddrIndex(vAddrId, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 4U);
+    for (unsigned int i = 1; i < vpos.size(); i++)
+        BOOST_CHECK(vpos[i-1] < vpos[i]);
+
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(vAddrId, vpos, 0, std::numeric_limits<int>::max(), 1, 2));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == MakePos(0, 8, 200, 1));
+    BOOST_CHECK(vpos[1] == MakePos(0, 500, 81, 3));
+
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(vAddrId, vpos, 0, 3, 0, 2, true));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == MakePos(0, 500, 81, 3));
+    BOOST_CHECK(vpos[1] == MakePos(0, 8, 200, 1));
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_legacy_entries)
+{
+    CBlockTreeDB db(1 << 20, true);
+
+    // An entry keyed by the truncated, salted hash of an earlier version, and its salt
+    unsigned char foo[0];
+    std::pair<std::pair<char, uint64_t>, CExtDiskTxPos> keyLegacy(std::make_pair('a', (uint64_t)12345), MakePos(0, 8, 81, 1));
+    BOOST_CHECK(db.Write(keyLegacy, FLATDATA(foo)));
+    BOOST_CHECK(db.Write('S', uint256(7)));
+    BOOST_CHECK(db.Write(std::make_pair('b', uint256(1)), FLATDATA(foo)));
+    BOOST_CHECK(db.EraseLegacyAddrIndex());
+    BOOST_CHECK(!db.Exists(keyLegacy));
+    BOOST_CHECK(!db.Exists('S'));
+    BOOST_CHECK(db.Exists(std::make_pair('b', uint256(1))));
+}
+
+static CAddrSummary MakeSummary(CAmount nReceived, CAmount nSent, unsigned int nTxCount, int nFirstHeight, int nLastHeight)
+{
+    CAddrSummary summary;
+    summary.nReceived = nReceived;
+    summary.nSent = nSent;
+    summary.nTxCount = nTxCount;
+    summary.nFirstHeight = nFirstHeight;
+    summary.nLastHeight = nLastHeight;
+    return summary;
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_summary)
+{
+    CAddrIndexDB db(1 << 20, true);
+    uint160 addrid(4);
+
+    // Connect blocks with transactions at heights 10 and 20
+    CAddrIndexUpdate first;
+    first.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 8, 81, 10)));
+    first.mapSummary[addrid] = MakeSummary(5000, 0, 1, 10, 10);
+    BOOST_CHECK(db.WriteAddrIndex(first, uint256(10)));
+
+    CAddrIndexUpdate second;
+    second.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 800, 81, 20)));
+    second.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 800, 300, 20)));
+    second.mapSummary[addrid] = MakeSummary(1000, 4000, 2, 20, 20);
+    BOOST_CHECK(db.WriteAddrIndex(second, uint256(20)));
+
+    CAddrSummary summary;
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary));
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 2000);
+    BOOST_CHECK_EQUAL(summary.nTxCount, 3U);
+    BOOST_CHECK_EQUAL(summary.nFirstHeight, 10);
+    BOOST_CHECK_EQUAL(summary.nLastHeight, 20);
+
+    // Disconnecting the second block restores the last height from the address index,
+    // which still holds the entries of the block, while the summary is read
+    BOOST_CHECK(db.WriteAddrIndex(second, uint256(10), true));
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary));
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 5000);
+    BOOST_CHECK_EQUAL(summary.nTxCount, 1U);
+    BOOST_CHECK_EQUAL(summary.nLastHeight, 10);
+
+    // Disconnecting the first block removes the summary
+    BOOST_CHECK(db.WriteAddrIndex(first, uint256(0), true));
+    BOOST_CHECK(!db.Exists(std::make_pair('s', addrid)));
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary));
+    BOOST_CHECK_EQUAL(summary.nTxCount, 0U);
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 0);
+    std::vector<CExtDiskTxPos> vpos;
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos));
+    BOOST_CHECK(vpos.empty());
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_summary_merge)
+{
+    // The summaries of consecutive blocks are merged in the order of the chain,
+    // before the changes of many blocks are written in one batch
+    CAddrSummary merged;
+    merged.Add(MakeSummary(5000, 0, 1, 3, 3));
+    merged.Add(MakeSummary(0, 5000, 2, 7, 9));
+    merged.Add(MakeSummary(700, 0, 1, 12, 12));
+    BOOST_CHECK_EQUAL(merged.nTxCount, 4U);
+    BOOST_CHECK_EQUAL(merged.nReceived, 5700);
+    BOOST_CHECK_EQUAL(merged.GetBalance(), 700);
+    BOOST_CHECK_EQUAL(merged.nFirstHeight, 3);
+    BOOST_CHECK_EQUAL(merged.nLastHeight, 12);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_update)
+{
+    CAddrIndexDB db(1 << 20, true);
+    uint160 addrid(5);
+    uint256 hashFirst(1), hashSecond(2), hashBest;
+    BOOST_CHECK(!db.ReadAddrIndexBest(hashBest));
+
+    // A block paying to addrid
+    CAddrIndexUpdate first;
+    first.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 8, 81, 1)));
+    COutPoint outFirst(uint256(10), 0);
+    first.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, outFirst), CAddrUnspent(CTxOut(5000, CScript()), 1)));
+    first.mapSummary[addrid] = MakeSummary(5000, 0, 1, 1, 1);
+    BOOST_CHECK(db.WriteAddrIndex(first, hashFirst));
+    BOOST_CHECK(db.ReadAddrIndexBest(hashBest));
+    BOOST_CHECK(hashBest == hashFirst);
+
+    // A block spending that output, and paying to addrid again within the same transaction
+    CAddrIndexUpdate second;
+    second.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 800, 81, 2)));
+    COutPoint outSecond(uint256(11), 0);
+    second.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, outSecond), CAddrUnspent(CTxOut(4000, CScript()), 2)));
+    second.vUnspentErase.push_back(std::make_pair(addrid, outFirst));
+    second.mapSummary[addrid] = MakeSummary(4000, 5000, 1, 2, 2);
+    boost::scoped_ptr<CLevelDBSnapshot> psnapshot(db.NewSnapshot());
+    BOOST_CHECK(db.WriteAddrIndex(second, hashSecond));
+
+    std::vector<CExtDiskTxPos> vpos;
+    std::vector<std::pair<COutPoint, CAddrUnspent> > vUnspent;
+    CAddrSummary summary;
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(ReadUnspent(db, addrid, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first == outSecond);
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary));
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 4000);
+    BOOST_CHECK_EQUAL(summary.nLastHeight, 2);
+
+    // A snapshot taken before the second block still reads the index as of the first one
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos, 0, std::numeric_limits<int>::max(), 0, std::numeric_limits<size_t>::max(), false, psnapshot.get()));
+    BOOST_CHECK_EQUAL(vpos.size(), 1U);
+    vUnspent.clear();
+    BOOST_CHECK(ReadUnspent(db, addrid, vUnspent, psnapshot.get()));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first == outFirst);
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary, psnapshot.get()));
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 5000);
+    psnapshot.reset();
+
+    // Reverting the second block, with its spent output restored, and the marker moved back
+    CAddrIndexUpdate revert;
+    revert.vPosAddrid = second.vPosAddrid;
+    revert.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, outFirst), CAddrUnspent(CTxOut(5000, CScript()), 1)));
+    revert.vUnspentErase.push_back(std::make_pair(addrid, outSecond));
+    revert.mapSummary = second.mapSummary;
+    BOOST_CHECK(db.WriteAddrIndex(revert, hashFirst, true));
+    BOOST_CHECK(db.ReadAddrIndexBest(hashBest));
+    BOOST_CHECK(hashBest == hashFirst);
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 1U);
+    vUnspent.clear();
+    BOOST_CHECK(ReadUnspent(db, addrid, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first == outFirst);
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary));
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 5000);
+    BOOST_CHECK_EQUAL(summary.nLastHeight, 1);
+
+    // The whole index can be erased for a rebuild
+    BOOST_CHECK(db.WipeAddrIndex());
+    BOOST_CHECK(!db.ReadAddrIndexBest(hashBest));
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos));
+    BOOST_CHECK(vpos.empty());
+    vUnspent.clear();
+    BOOST_CHECK(ReadUnspent(db, addrid, vUnspent));
+    BOOST_CHECK(vUnspent.empty());
+    BOOST_CHECK(!db.Exists(std::make_pair('s', addrid)));
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_unspent_pages)
+{
+    CAddrIndexDB db(1 << 20, true);
+    uint160 addrid(7);
+
+    CAddrIndexUpdate update;
+    for (int i = 0; i < 4; i++)
+        update.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, COutPoint(uint256(20 + i), 0)), CAddrUnspent(CTxOut(1000, CScript()), 4 - i)));
+    update.vUnspentAdd.push_back(std::make_pair(std::make_pair(uint160(8), COutPoint(uint256(30), 0)), CAddrUnspent(CTxOut(1000, CScript()), 1)));
+    BOOST_CHECK(db.WriteAddrIndex(update, uint256(1)));
+
+    // Pages continue after the last outpoint read, in the order of the outpoints
+    std::vector<std::pair<COutPoint, CAddrUnspent> > vUnspent;
+    BOOST_CHECK(db.ReadAddrUnspentIndex(addrid, vUnspent, 0, NULL, 3));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 3U);
+    COutPoint after = vUnspent.back().first;
+    std::vector<std::pair<COutPoint, CAddrUnspent> > vNext;
+    BOOST_CHECK(db.ReadAddrUnspentIndex(addrid, vNext, 0, &after, 3));
+    BOOST_CHECK_EQUAL(vNext.size(), 1U);
+    vUnspent.insert(vUnspent.end(), vNext.begin(), vNext.end());
+    for (unsigned int i = 1; i < vUnspent.size(); i++)
+        BOOST_CHECK(vUnspent[i-1].first < vUnspent[i].first);
+
+    // Outputs below the minimal height do not count toward the limit
+    vUnspent.clear();
+    BOOST_CHECK(db.ReadAddrUnspentIndex(addrid, vUnspent, 3, NULL, 3));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 2U);
+    BOOST_CHECK(vUnspent[0].second.nHeight >= 3 && vUnspent[1].second.nHeight >= 3);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_merged_update)
+{
+    CAddrIndexDB db(1 << 20, true);
+    uint160 addrid(6);
+    COutPoint outFirst(uint256(10), 0), outSecond(uint256(11), 0);
+
+    CAddrIndexUpdate first;
+    first.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 8, 81, 1)));
+    first.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, outFirst), CAddrUnspent(CTxOut(5000, CScript()), 1)));
+    first.mapSummary[addrid] = MakeSummary(5000, 0, 1, 1, 1);
+    CAddrIndexUpdate second;
+    second.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 800, 81, 2)));
+    second.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, outSecond), CAddrUnspent(CTxOut(4000, CScript()), 2)));
+    second.vUnspentErase.push_back(std::make_pair(addrid, outFirst));
+    second.mapSummary[addrid] = MakeSummary(4000, 5000, 1, 2, 2);
+
+    // The buffered changes of both blocks are written at once, as if written block by block
+    CAddrIndexUpdate pending;
+    pending.Add(first);
+    pending.Add(second);
+    BOOST_CHECK_EQUAL(pending.GetCount(), 6U);
+    BOOST_CHECK(db.WriteAddrIndex(pending, uint256(2)));
+
+    std::vector<CExtDiskTxPos> vpos;
+    std::vector<std::pair<COutPoint, CAddrUnspent> > vUnspent;
+    CAddrSummary summary;
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(ReadUnspent(db, addrid, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first == outSecond);
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary));
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 4000);
+    BOOST_CHECK_EQUAL(summary.nTxCount, 2U);
+    BOOST_CHECK_EQUAL(summary.nFirstHeight, 1);
+    BOOST_CHECK_EQUAL(summary.nLastHeight, 2);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_pending)
+{
+    CAddrIndexDB db(1 << 20, true);
+    uint160 addrid(6);
+    COutPoint outFirst(uint256(10), 0), outSecond(uint256(11), 0), outThird(uint256(12), 1);
+
+    CAddrIndexUpdate first;
+    first.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 8, 81, 1)));
+    first.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, outFirst), CAddrUnspent(CTxOut(5000, CScript()), 1)));
+    first.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, outThird), CAddrUnspent(CTxOut(3000, CScript()), 1)));
+    BOOST_CHECK(db.WriteAddrIndex(first, uint256(1)));
+
+    // The changes of the second block are not written, but read next to the database
+    CAddrIndexUpdate second;
+    second.vPosAddrid.push_back(std::make_pair(uint160(7), MakePos(0, 800, 81, 2)));
+    second.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 800, 200, 2)));
+    second.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 800, 81, 2)));
+    second.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, outSecond), CAddrUnspent(CTxOut(4000, CScript()), 2)));
+    second.vUnspentErase.push_back(std::make_pair(addrid, outFirst));
+    second.Sort();
+
+    std::vector<CExtDiskTxPos> vPending;
+    second.GetAddrIndex(addrid, 0, std::numeric_limits<int>::max(), vPending);
+    BOOST_CHECK_EQUAL(vPending.size(), 2U);
+    BOOST_CHECK(vPending[0] < vPending[1]);
+    std::vector<CExtDiskTxPos> vpos;
+    BOOST_CHECK(db.ReadAddrIndex(std::vector<uint160>(1, addrid), vpos, 0, std::numeric_limits<int>::max(), 1, 2, false, NULL, &vPending));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == vPending[0] && vpos[1] == vPending[1]);
+    vpos.clear();
+    BOOST_CHECK(db.ReadAddrIndex(std::vector<uint160>(1, addrid), vpos, 0, std::numeric_limits<int>::max(), 1, 2, true, NULL, &vPending));
+    BOOST_CHECK_EQUAL(vpos.size(), 2U);
+    BOOST_CHECK(vpos[0] == vPending[0] && vpos[1] == MakePos(0, 8, 81, 1));
+
+    // Erased outputs are left out, and added ones are found in the order of the keys
+    CAddrUnspentChanges mapChanges;
+    second.GetAddrUnspent(addrid, mapChanges);
+    BOOST_CHECK_EQUAL(mapChanges.size(), 2U);
+    std::vector<std::pair<COutPoint, CAddrUnspent> > vUnspent;
+    BOOST_CHECK(db.ReadAddrUnspentIndex(addrid, vUnspent, 0, NULL, std::numeric_limits<size_t>::max(), NULL, &mapChanges));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 2U);
+    BOOST_CHECK(vUnspent[0].first == outSecond && vUnspent[1].first == outThird);
+    vUnspent.clear();
+    BOOST_CHECK(db.ReadAddrUnspentIndex(addrid, vUnspent, 0, &outSecond, 1, NULL, &mapChanges));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first == outThird);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_stats)
+{
+    CAddrIndexDB db(1 << 20, true);
+
+    // Addresses 1 to 5 with as many transactions, and an unspent output each
+    CAddrIndexUpdate update;
+    for (int i = 1; i <= 5; i++) {
+        uint160 addrid(i);
+        for (int j = 0; j < i; j++)
+            update.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 8 + j, 81, j + 1)));
+        update.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, COutPoint(uint256(i), 0)), CAddrUnspent(CTxOut(1000, CScript()), 1)));
+        update.mapSummary[addrid] = MakeSummary(1000 * i, 0, i, 1, i);
+    }
+    // and an entry without a summary, which is counted as a transaction entry too
+    update.vPosAddrid.push_back(std::make_pair(uint160(6), MakePos(0, 8, 81, 1)));
+    BOOST_CHECK(db.WriteAddrIndex(update, uint256(1)));
+
+    CAddrIndexStats stats;
+    BOOST_CHECK(db.GetAddrIndexStats(stats, 3));
+    BOOST_CHECK_EQUAL(stats.nAddresses, 5U);
+    BOOST_CHECK_EQUAL(stats.nHistoryEntries, 16U);
+    BOOST_CHECK_EQUAL(stats.nUnspentEntries, 5U);
+    BOOST_CHECK_EQUAL(stats.vTop.size(), 3U);
+    BOOST_CHECK(stats.vTop[0].first == uint160(5));
+    BOOST_CHECK(stats.vTop[1].first == uint160(4));
+    BOOST_CHECK(stats.vTop[2].first == uint160(3));
+    BOOST_CHECK_EQUAL(stats.vTop[0].second.nReceived, 5000);
+
+    // Compaction keeps the entries
+    db.CompactAddrIndex();
+    CAddrIndexStats statsCompacted;
+    BOOST_CHECK(db.GetAddrIndexStats(statsCompacted, 0));
+    BOOST_CHECK_EQUAL(statsCompacted.nHistoryEntries, 16U);
+    BOOST_CHECK_EQUAL(statsCompacted.nUnspentEntries, 5U);
+    BOOST_CHECK(statsCompacted.vTop.empty());
+    std::vector<CExtDiskTxPos> vpos;
+    BOOST_CHECK(db.ReadAddrIndex(uint160(5), vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 5U);
+}
+
+BOOST_AUTO_TEST_CASE(addrindex_move)
+{
+    CBlockTreeDB blocktree(1 << 20, true);
+    CAddrIndexDB db(1 << 20, true);
+    uint160 addrid(6);
+    uint256 hashBlock(1), hashBest;
+
+    // An index kept in the block database by an earlier version
+    CAddrIndexDB dbEarlier(1 << 20, true);
+    CAddrIndexUpdate update;
+    update.vPosAddrid.push_back(std::make_pair(addrid, MakePos(0, 8, 81, 1)));
+    update.vUnspentAdd.push_back(std::make_pair(std::make_pair(addrid, COutPoint(uint256(10), 0)), CAddrUnspent(CTxOut(5000, CScript()), 1)));
+    update.mapSummary[addrid] = MakeSummary(5000, 0, 1, 1, 1);
+    BOOST_CHECK(dbEarlier.WriteAddrIndex(update, hashBlock));
+    boost::scoped_ptr<leveldb::Iterator> pcursor(dbEarlier.NewIterator());
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+        std::string strKey = pcursor->key().ToString(), strValue = pcursor->value().ToString();
+        BOOST_CHECK(blocktree.Write(CFlatData(&strKey[0], &strKey[0] + strKey.size()), CFlatData(&strValue[0], &strValue[0] + strValue.size())));
+    }
+    BOOST_CHECK(blocktree.Write(std::make_pair('t', uint256(2)), CDiskTxPos()));
+
+    // A move replaces what the address index database held
+    CAddrIndexUpdate stale;
+    stale.mapSummary[uint160(7)] = MakeSummary(100, 0, 1, 1, 1);
+    BOOST_CHECK(db.WriteAddrIndex(stale, uint256(3)));
+    BOOST_CHECK(blocktree.MoveAddrIndex(db));
+
+    BOOST_CHECK(db.ReadAddrIndexBest(hashBest));
+    BOOST_CHECK(hashBest == hashBlock);
+    std::vector<CExtDiskTxPos> vpos;
+    BOOST_CHECK(db.ReadAddrIndex(addrid, vpos));
+    BOOST_CHECK_EQUAL(vpos.size(), 1U);
+    std::vector<std::pair<COutPoint, CAddrUnspent> > vUnspent;
+    BOOST_CHECK(ReadUnspent(db, addrid, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    CAddrSummary summary;
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary));
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 5000);
+    BOOST_CHECK(!db.Exists(std::make_pair('s', uint160(7))));
+
+    // Only the address index is removed from the block database, and moving again does nothing
+    BOOST_CHECK(!blocktree.Exists('A'));
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('s', addrid)));
+    BOOST_CHECK(blocktree.Exists(std::make_pair('t', uint256(2))));
+    BOOST_CHECK(blocktree.MoveAddrIndex(db));
+    BOOST_CHECK(db.ReadAddrSummary(addrid, summary));
+    BOOST_CHECK_EQUAL(summary.GetBalance(), 5000);
+}
+
+static void SetTrue(bool *pf, CCoinsViewDB *pdb, uint256 hashBlock)
+{
+    // the coins of the best block are written already
+    *pf = pdb->GetBestBlock() == hashBlock;
+}
+
+BOOST_AUTO_TEST_CASE(coins_background_writer)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewDBWriter writer(&db, &db);
+    std::vector<uint256> vTxid;
+    uint256 hashBlock;
+    for (int n = 0; n < 10; n++) {
+        // the coins flushed before are found, whether or not their write has completed
+        CCoinsViewCache cache(&writer);
+        for (int i = 0; i < (int)vTxid.size(); i++) {
+            const CCoins *coins = cache.AccessCoins(vTxid[i]);
+            BOOST_CHECK(coins && coins->vout[0].nValue == i);
+        }
+        if (n > 0)
+            cache.ModifyCoins(vTxid[0])->vout[0].nValue = 0;
+        for (int i = 0; i < 100; i++) {
+            vTxid.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyCoins(vTxid.back());
+            coins->nVersion = 1;
+            coins->vout.push_back(CTxOut(vTxid.size() - 1, CScript() << OP_TRUE));
+        }
+        hashBlock = GetRandHash();
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(writer.GetBestBlock() == hashBlock);
+    }
+
+    // the database moves on to the best block once the coins are written
+    BOOST_CHECK(writer.Sync());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(vTxid.back(), coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, (CAmount)vTxid.size() - 1);
+
+    // spent coins are erased
+    {
+        CCoinsViewCache cache(&writer);
+        cache.ModifyCoins(vTxid.back())->Spend(0);
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!writer.HaveCoins(vTxid.back()));
+    BOOST_CHECK(writer.Sync());
+    BOOST_CHECK(!db.HaveCoins(vTxid.back()));
+
+    // the coins being written are counted until they are written, after which the
+    // notification of their best block is sent, at the latest before the writer stops
+    bool fNotified = false;
+    {
+        CCoinsViewDBWriter writerNotify(&db, &db);
+        CCoinsViewCache cache(&writerNotify);
+        cache.ModifyCoins(vTxid[1])->vout[0].nValue = 0;
+        hashBlock = GetRandHash();
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+        writerNotify.CallWhenWritten(boost::bind(&SetTrue, &fNotified, &db, hashBlock));
+        BOOST_CHECK(writerNotify.Sync());
+        BOOST_CHECK_EQUAL(writerNotify.DynamicMemoryUsage(), 0U);
+    }
+    BOOST_CHECK(fNotified);
+}
+
+BOOST_AUTO_TEST_CASE(coins_stats)
+{
+    CCoinsViewDB db(1 << 20, true), dbOther(1 << 20, true);
+    uint256 hashBlock = GetRandHash();
+    CScript scriptP2PKH = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript scriptP2SH = CScript() << OP_HASH160 << std::vector<unsigned char>(20, 2) << OP_EQUAL;
+    std::map<uint256, CCoins> mapAll;
+    for (int i = 0; i < 1000; i++) {
+        CCoins &coins = mapAll[GetRandHash()];
+        coins.nVersion = 1;
+        coins.nHeight = i;
+        coins.vout.push_back(CTxOut(i, scriptP2PKH));
+        coins.vout.push_back(CTxOut(COIN, i % 2 ? scriptP2SH : CScript() << OP_TRUE));
+    }
+
+    // the same coins are written at once, and in several batches
+    CCoinsMap mapCoins, mapCoinsOther;
+    for (std::map<uint256, CCoins>::iterator it = mapAll.begin(); it != mapAll.end(); it++) {
+        CCoinsCacheEntry &entry = mapCoins[it->first], &entryOther = mapCoinsOther[it->first];
+        entry.coins = entryOther.coins = it->second;
+        entry.flags = entryOther.flags = CCoinsCacheEntry::DIRTY;
+        if (mapCoinsOther.size() == 300) {
+            BOOST_CHECK(dbOther.BatchWrite(mapCoinsOther, hashBlock));
+            mapCoinsOther.clear();
+        }
+    }
+    BOOST_CHECK(db.BatchWrite(mapCoins, hashBlock));
+    BOOST_CHECK(dbOther.BatchWrite(mapCoinsOther, hashBlock));
+
+    CCoinsStats stats, statsOther;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK(stats.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 1000U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 2000U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 999 * 1000 / 2 + 1000 * COIN);
+    BOOST_CHECK_EQUAL(stats.vScriptTypeCount[TX_PUBKEYHASH], 1000U);
+    BOOST_CHECK_EQUAL(stats.vScriptTypeCount[TX_SCRIPTHASH], 500U);
+    BOOST_CHECK_EQUAL(stats.vScriptTypeCount[TX_NONSTANDARD], 500U);
+    BOOST_CHECK_EQUAL(stats.vValueCount[0], 1U);
+    BOOST_CHECK_EQUAL(stats.vValueCount[1], 9U);
+    BOOST_CHECK_EQUAL(stats.vValueCount[2], 90U);
+    BOOST_CHECK_EQUAL(stats.vValueCount[3], 900U);
+    BOOST_CHECK_EQUAL(stats.vValueCount[9], 1000U);
+
+    // the hash does not depend on the order of the writes, or on the number of threads
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = 4;
+    BOOST_CHECK(dbOther.GetStats(statsOther));
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+    BOOST_CHECK(statsOther.hashSerialized == stats.hashSerialized);
+    BOOST_CHECK_EQUAL(statsOther.nSerializedSize, stats.nSerializedSize);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
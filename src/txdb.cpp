@@ -5,11 +5,17 @@
 
 #include "txdb.h"
 
+#include "crypto/common.h"
+#include "memusage.h"
 #include "pow.h"
+#include "script/standard.h"
 #include "uint256.h"
 
+#include <algorithm>
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -44,17 +50,21 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool ret = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             BatchWriteCoins(batch, it->first, it->second.coins);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
@@ -63,11 +73,152 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
-    if (!Read('S', salt)) {
-        salt = GetRandHash();
-        Write('S', salt);
+CCoinsViewDBWriter::CCoinsViewDBWriter(CCoinsView *baseIn, CCoinsViewDB *pdbIn) : CCoinsViewBacked(baseIn), pdb(pdbIn), hashWriting(0), nWritingUsage(0), fWriting(false), fFailed(false), fStop(false) {
+    thread = boost::thread(&CCoinsViewDBWriter::ThreadWrite, this);
+}
+
+CCoinsViewDBWriter::~CCoinsViewDBWriter() {
+    Sync();
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    thread.interrupt();
+    thread.join();
+}
+
+void CCoinsViewDBWriter::ThreadWrite() {
+    RenameThread("bitcoin-coinwriter");
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (true) {
+        while (!fWriting && !fStop)
+            cond.wait(lock);
+        if (!fWriting)
+            return;
+        boost::this_thread::interruption_point();
+
+        // mapWriting is only read while the write runs, by this thread and by readers under cs
+        bool fOk = false;
+        lock.unlock();
+        int64_t nStart = GetTimeMicros();
+        try {
+            fOk = pdb->WriteCoins(mapWriting, hashWriting);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        LogPrint("bench", "    - Background coin write: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+        lock.lock();
+
+        boost::function<void()> fn;
+        fn.swap(fnWritten);
+        if (fOk) {
+            CCoinsMap().swap(mapWriting);
+            hashWriting = 0;
+            nWritingUsage = 0;
+        } else {
+            LogPrintf("%s: failed to write to coin database\n", __func__);
+            fFailed = true;
+            fn.clear();
+        }
+        // the next flush does not wait for the notification, which may take locks of its own
+        fWriting = false;
+        cond.notify_all();
+        if (fn) {
+            lock.unlock();
+            fn();
+            lock.lock();
+        }
+    }
+}
+
+bool CCoinsViewDBWriter::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = mapWriting.find(txid);
+        if (it != mapWriting.end()) {
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewDBWriter::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = mapWriting.find(txid);
+        if (it != mapWriting.end())
+            return !it->second.coins.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewDBWriter::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (hashWriting != 0)
+            return hashWriting;
     }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewDBWriter::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fWriting)
+        cond.wait(lock);
+    if (fFailed)
+        return false;
+    // only the dirty entries need to be kept until they are written
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        CCoinsMap::iterator itOld = it++;
+        if (!(itOld->second.flags & CCoinsCacheEntry::DIRTY))
+            mapCoins.erase(itOld);
+    }
+    mapWriting.swap(mapCoins);
+    mapCoins.clear();
+    hashWriting = hashBlock;
+    nWritingUsage = memusage::DynamicUsage(mapWriting);
+    for (CCoinsMap::const_iterator it = mapWriting.begin(); it != mapWriting.end(); it++)
+        nWritingUsage += it->second.coins.DynamicMemoryUsage();
+    fWriting = true;
+    cond.notify_all();
+    return true;
+}
+
+bool CCoinsViewDBWriter::GetStats(CCoinsStats &stats) const {
+    return Sync() && base->GetStats(stats);
+}
+
+bool CCoinsViewDBWriter::Sync() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fWriting)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+void CCoinsViewDBWriter::CallWhenWritten(const boost::function<void()> &fn) {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fFailed)
+            return;
+        if (fWriting) {
+            fnWritten = fn;
+            return;
+        }
+    }
+    fn();
+}
+
+size_t CCoinsViewDBWriter::DynamicMemoryUsage() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return nWritingUsage;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+}
+
+CAddrIndexDB::CAddrIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "indexes" / "addr", nCacheSize, fMemory, fWipe) {
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
@@ -103,31 +254,50 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+namespace {
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
+//! Number of value classes of CCoinsStats::vValueCount: 0, and the powers of ten up to MAX_MONEY
+static const size_t COINS_STATS_VALUE_CLASSES = 17;
+
+/**
+ * Collects the statistics of the coin database on several threads. The coins are split into
+ * 256 shards by the first byte of their txid, which are read from the same snapshot. Each shard
+ * is hashed on its own, and the hash of the whole set is that of the best block and the shard
+ * hashes in order, so that it does not depend on the number of threads.
+ */
+class CCoinsStatsCollector
+{
+private:
+    boost::mutex mutex;
+    CLevelDBWrapper &db;
+    const CLevelDBSnapshot *psnapshot;
+    size_t nNext;   //! next shard to collect
+    bool fOk;
+    std::vector<CCoinsStats> vShard;
+
+    bool CollectShard(unsigned char chShard, CCoinsStats &stats) {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator(psnapshot));
+        const char chKey[2] = {'c', (char)chShard};
+        pcursor->Seek(leveldb::Slice(chKey, 2));
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        std::vector<std::vector<unsigned char> > vSolutions;
+        stats.vScriptTypeCount.assign(TX_NULL_DATA + 1, 0);
+        stats.vValueCount.assign(COINS_STATS_VALUE_CLASSES, 0);
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
+            if (slKey.size() < 2 || slKey[0] != 'c' || (unsigned char)slKey[1] != chShard)
+                break;
+            try {
+                CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                uint256 txhash;
+                ssKey >> chType >> txhash;
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
                 CCoins coins;
                 ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
                 ss << txhash;
                 ss << VARINT(coins.nVersion);
                 ss << (coins.fCoinBase ? 'c' : 'n');
@@ -139,21 +309,98 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
                         stats.nTransactionOutputs++;
                         ss << VARINT(i+1);
                         ss << out;
-                        nTotalAmount += out.nValue;
+                        stats.nTotalAmount += out.nValue;
+                        txnouttype type;
+                        if (!Solver(out.scriptPubKey, type, vSolutions))
+                            type = TX_NONSTANDARD;
+                        stats.vScriptTypeCount[type]++;
+                        size_t nClass = 0;
+                        for (CAmount nValue = out.nValue; nValue > 0 && nClass + 1 < COINS_STATS_VALUE_CLASSES; nValue /= 10)
+                            nClass++;
+                        stats.vValueCount[nClass]++;
                     }
                 }
                 stats.nSerializedSize += 32 + slValue.size();
                 ss << VARINT(0);
+            } catch (const std::exception &e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
             pcursor->Next();
-        } catch (std::exception &e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
+        stats.hashSerialized = ss.GetHash();
+        return true;
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
-    return true;
+
+    void ThreadCollect() {
+        while (true) {
+            size_t nShard;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (!fOk || nNext == vShard.size())
+                    return;
+                nShard = nNext++;
+            }
+            if (!CollectShard(nShard, vShard[nShard])) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                fOk = false;
+            }
+        }
+    }
+
+public:
+    CCoinsStatsCollector(CLevelDBWrapper &dbIn, const CLevelDBSnapshot *psnapshotIn) :
+        db(dbIn), psnapshot(psnapshotIn), nNext(0), fOk(true), vShard(256) {}
+
+    //! Collect the statistics of the coins into stats, whose hashBlock must be set
+    bool Collect(CCoinsStats &stats, int nThreads) {
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CCoinsStatsCollector::ThreadCollect, this));
+        try {
+            threads.join_all();
+        } catch (const boost::thread_interrupted&) {
+            // the collecting threads stop with their caller, before the collector goes away
+            threads.interrupt_all();
+            threads.join_all();
+            throw;
+        }
+        if (!fOk)
+            return false;
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << stats.hashBlock;
+        stats.vScriptTypeCount.assign(TX_NULL_DATA + 1, 0);
+        stats.vValueCount.assign(COINS_STATS_VALUE_CLASSES, 0);
+        for (std::vector<CCoinsStats>::const_iterator it = vShard.begin(); it != vShard.end(); ++it) {
+            stats.nTransactions += it->nTransactions;
+            stats.nTransactionOutputs += it->nTransactionOutputs;
+            stats.nSerializedSize += it->nSerializedSize;
+            stats.nTotalAmount += it->nTotalAmount;
+            for (unsigned int i = 0; i < stats.vScriptTypeCount.size(); i++)
+                stats.vScriptTypeCount[i] += it->vScriptTypeCount[i];
+            for (unsigned int i = 0; i < stats.vValueCount.size(); i++)
+                stats.vValueCount[i] += it->vValueCount[i];
+            ss << it->hashSerialized;
+        }
+        stats.hashSerialized = ss.GetHash();
+        return true;
+    }
+};
+
+}
+
+bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+    /* It seems that there are no "const iterators" for LevelDB.  Since we
+       only need read operations on it, use a const-cast to get around
+       that restriction.  */
+    CLevelDBWrapper &dbRead = const_cast<CLevelDBWrapper&>(db);
+    // The coins are read from a snapshot, so that blocks can be connected meanwhile.
+    boost::scoped_ptr<CLevelDBSnapshot> psnapshot(dbRead.NewSnapshot());
+    if (!db.Read('B', stats.hashBlock, psnapshot.get()))
+        stats.hashBlock = 0;
+
+    CCoinsStatsCollector collector(dbRead, psnapshot.get());
+    return collector.Collect(stats, std::max(nScriptCheckThreads, 1));
 }
 
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
@@ -167,52 +414,570 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddrIndex(uint160 addrid, std::vector<CExtDiskTxPos> &list) {
-    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
-    uint64_t lookupid;
-    {
-        CHashWriter ss(SER_GETHASH, 0);
-        ss << salt;
-        ss << addrid;
-        lookupid = ss.GetHash().GetLow64();
+/**
+ * Key of an address index entry. The full address id is stored, so that entries never
+ * match another address. The height and disk position are stored big-endian, so that
+ * the entries of an address are sorted by their position in the block chain.
+ */
+struct CAddrIndexKey
+{
+    uint160 addrid;
+    CExtDiskTxPos pos;
+
+    CAddrIndexKey() : addrid(0) {}
+    CAddrIndexKey(const uint160 &addridIn, const CExtDiskTxPos &posIn) : addrid(addridIn), pos(posIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 1 + 20 + 16;
     }
-    {
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey << std::make_pair('a', lookupid);
-        leveldb::Slice slKey(&ssKey[0], ssKey.size());
-        pcursor->Seek(slKey);
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        unsigned char data[16];
+        WriteBE32(&data[0], pos.nHeight);
+        WriteBE32(&data[4], pos.nFile);
+        WriteBE32(&data[8], pos.nPos);
+        WriteBE32(&data[12], pos.nTxOffset);
+        s << 'd';
+        s << addrid;
+        s << FLATDATA(data);
     }
-    while (pcursor->Valid()) {
-        std::pair<std::pair<char, uint64_t>, CExtDiskTxPos> key;
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        char chType;
+        unsigned char data[16];
+        s >> chType;
+        if (chType != 'd')
+            throw std::ios_base::failure("CAddrIndexKey::Unserialize : not an address index key");
+        s >> addrid;
+        s >> FLATDATA(data);
+        pos.nHeight = ReadBE32(&data[0]);
+        pos.nFile = ReadBE32(&data[4]);
+        pos.nPos = ReadBE32(&data[8]);
+        pos.nTxOffset = ReadBE32(&data[12]);
+    }
+};
+
+/** Iterator over the address index entries of one address within a height range, in either direction */
+class CAddrIndexCursor
+{
+private:
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+    uint160 addrid;
+    unsigned int nMinHeight;
+    unsigned int nMaxHeight;
+    bool fReverse;
+
+    void Read() {
+        fValid = false;
+        if (!pcursor->Valid())
+            return;
+        CAddrIndexKey key;
         leveldb::Slice slKey = pcursor->key();
         try {
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             ssKey >> key;
         } catch(std::exception &e) {
-            break;
+            return;
         }
-        if (key.first.first == 'a' && key.first.second == lookupid) {
-            list.push_back(key.second);
+        if (key.addrid != addrid)
+            return;
+        if (fReverse ? key.pos.nHeight < nMinHeight : key.pos.nHeight > nMaxHeight)
+            return;
+        pos = key.pos;
+        fValid = true;
+    }
+
+public:
+    bool fValid;
+    CExtDiskTxPos pos;
+
+    CAddrIndexCursor(leveldb::Iterator *pcursorIn, const uint160 &addridIn, unsigned int nMinHeightIn, unsigned int nMaxHeightIn, bool fReverseIn) :
+        pcursor(pcursorIn), addrid(addridIn), nMinHeight(nMinHeightIn), nMaxHeight(nMaxHeightIn), fReverse(fReverseIn), fValid(false) {
+        // forward scans start at the first entry within the range, reverse scans
+        // right before the first entry above the range
+        CExtDiskTxPos posStart(CDiskTxPos(CDiskBlockPos(0, 0), 0), fReverse ? nMaxHeight + 1 : nMinHeight);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << CAddrIndexKey(addrid, posStart);
+        leveldb::Slice slKey(&ssKey[0], ssKey.size());
+        pcursor->Seek(slKey);
+        if (fReverse) {
+            if (pcursor->Valid())
+                pcursor->Prev();
+            else
+                pcursor->SeekToLast();
+        }
+        Read();
+    }
+
+    void Next() {
+        if (fReverse)
+            pcursor->Prev();
+        else
+            pcursor->Next();
+        Read();
+    }
+};
+
+/** Order cursors of a heap, so that the one with the next entry in the direction of the scan is on top */
+struct CompareAddrIndexCursor
+{
+    bool fReverse;
+    CompareAddrIndexCursor(bool fReverseIn) : fReverse(fReverseIn) {}
+    bool operator()(const boost::shared_ptr<CAddrIndexCursor> &a, const boost::shared_ptr<CAddrIndexCursor> &b) const {
+        return fReverse ? a->pos < b->pos : b->pos < a->pos;
+    }
+};
+
+bool CAddrIndexDB::ReadAddrIndex(uint160 addrid, std::vector<CExtDiskTxPos> &list, int nMinHeight, int nMaxHeight, size_t nSkip, size_t nLimit, bool fReverse,
+                                 const CLevelDBSnapshot *psnapshot) {
+    return ReadAddrIndex(std::vector<uint160>(1, addrid), list, nMinHeight, nMaxHeight, nSkip, nLimit, fReverse, psnapshot);
+}
+
+/** Select pos, unless one of the nSkip entries left to skip, and return false, once nLimit entries are selected */
+static bool SelectAddrIndexEntry(const CExtDiskTxPos &pos, std::vector<CExtDiskTxPos> &list, size_t &nSkip, size_t &nLimit) {
+    if (nSkip > 0) {
+        nSkip--;
+        return true;
+    }
+    list.push_back(pos);
+    return --nLimit > 0;
+}
+
+bool CAddrIndexDB::ReadAddrIndex(const std::vector<uint160> &vAddrId, std::vector<CExtDiskTxPos> &list, int nMinHeight, int nMaxHeight, size_t nSkip, size_t nLimit, bool fReverse,
+                                 const CLevelDBSnapshot *psnapshot, const std::vector<CExtDiskTxPos> *pvPending) {
+    if (nMinHeight < 0)
+        nMinHeight = 0;
+    if (nMaxHeight < nMinHeight || nLimit == 0)
+        return true;
+
+    // pending entries are the newest, and come first in a reverse scan
+    if (fReverse && pvPending) {
+        for (std::vector<CExtDiskTxPos>::const_reverse_iterator it = pvPending->rbegin(); it != pvPending->rend(); ++it)
+            if (!SelectAddrIndexEntry(*it, list, nSkip, nLimit))
+                return true;
+    }
+
+    // The entries of every address are already ordered, so they are merged through a heap of the
+    // cursors, which hands out the next entry of all of them, and only as many are read as are selected.
+    std::vector<boost::shared_ptr<CAddrIndexCursor> > vCursor;
+    for (std::vector<uint160>::const_iterator it = vAddrId.begin(); it != vAddrId.end(); ++it) {
+        boost::shared_ptr<CAddrIndexCursor> pcursor(new CAddrIndexCursor(NewIterator(psnapshot), *it, nMinHeight, nMaxHeight, fReverse));
+        if (pcursor->fValid)
+            vCursor.push_back(pcursor);
+    }
+    CompareAddrIndexCursor comp(fReverse);
+    std::make_heap(vCursor.begin(), vCursor.end(), comp);
+    bool fHavePrev = false;
+    CExtDiskTxPos posPrev;
+    while (!vCursor.empty()) {
+        boost::this_thread::interruption_point();
+        std::pop_heap(vCursor.begin(), vCursor.end(), comp);
+        CAddrIndexCursor &cursor = *vCursor.back();
+        // a transaction of several of the addresses is selected once
+        if (!fHavePrev || cursor.pos != posPrev) {
+            fHavePrev = true;
+            posPrev = cursor.pos;
+            if (!SelectAddrIndexEntry(posPrev, list, nSkip, nLimit))
+                return true;
+        }
+        cursor.Next();
+        if (cursor.fValid)
+            std::push_heap(vCursor.begin(), vCursor.end(), comp);
+        else
+            vCursor.pop_back();
+    }
+
+    if (!fReverse && pvPending) {
+        for (std::vector<CExtDiskTxPos>::const_iterator it = pvPending->begin(); it != pvPending->end(); ++it)
+            if (!SelectAddrIndexEntry(*it, list, nSkip, nLimit))
+                return true;
+    }
+    return true;
+}
+
+bool CAddrIndexDB::ReadAddrUnspentIndex(const uint160 &addrid, std::vector<std::pair<COutPoint, CAddrUnspent> > &list,
+                                        int nMinHeight, const COutPoint *pafter, size_t nLimit,
+                                        const CLevelDBSnapshot *psnapshot, const CAddrUnspentChanges *pchanges) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator(psnapshot));
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        if (pafter)
+            ssKey << std::make_pair(std::make_pair('u', addrid), *pafter);
+        else
+            ssKey << std::make_pair('u', addrid);
+        leveldb::Slice slKey(&ssKey[0], ssKey.size());
+        pcursor->Seek(slKey);
+    }
+    CAddrUnspentChanges mapNone;
+    if (!pchanges)
+        pchanges = &mapNone;
+    CAddrUnspentChanges::const_iterator itChange = pafter ? pchanges->upper_bound(*pafter) : pchanges->begin();
+    CompareOutPointKey comp;
+
+    // The outputs of the database and the changes are both in key order, and merged,
+    // with a change replacing the output of the database with the same outpoint.
+    size_t nRead = 0;
+    while (nRead < nLimit) {
+        boost::this_thread::interruption_point();
+        bool fValid = false;
+        std::pair<std::pair<char, uint160>, COutPoint> key;
+        if (pcursor->Valid()) {
+            leveldb::Slice slKey = pcursor->key();
+            try {
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                ssKey >> key;
+                fValid = key.first.first == 'u' && key.first.second == addrid;
+            } catch(std::exception &e) {
+            }
+        }
+        if (fValid && pafter && key.second == *pafter) {
+            pcursor->Next();
+            continue;
+        }
+
+        COutPoint outpoint;
+        boost::optional<CAddrUnspent> unspent;
+        if (itChange != pchanges->end() && (!fValid || !comp(key.second, itChange->first))) {
+            if (fValid && !comp(itChange->first, key.second))
+                pcursor->Next();
+            outpoint = itChange->first;
+            unspent = itChange->second;
+            ++itChange;
+        } else if (fValid) {
+            try {
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                unspent = CAddrUnspent();
+                ssValue >> *unspent;
+            } catch (std::exception &e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+            outpoint = key.second;
+            pcursor->Next();
         } else {
             break;
         }
-        pcursor->Next();
+        if (unspent && unspent->nHeight >= nMinHeight) {
+            list.push_back(std::make_pair(outpoint, *unspent));
+            nRead++;
+        }
+    }
+    return true;
+}
+
+bool CAddrIndexDB::ReadAddrSummary(const uint160 &addrid, CAddrSummary &summary, const CLevelDBSnapshot *psnapshot) {
+    // an address without transactions has no summary
+    if (!Read(std::make_pair('s', addrid), summary, psnapshot))
+        summary = CAddrSummary();
+    return true;
+}
+
+bool CAddrIndexDB::BatchAddrSummary(CLevelDBBatch &batch, const std::map<uint160, CAddrSummary> &mapSummary, bool fRevert) {
+    for (std::map<uint160, CAddrSummary>::const_iterator it = mapSummary.begin(); it != mapSummary.end(); ++it) {
+        const CAddrSummary &change = it->second;
+        CAddrSummary summary;
+        if (!ReadAddrSummary(it->first, summary))
+            return false;
+        if (!fRevert) {
+            summary.Add(change);
+        } else {
+            if (summary.nTxCount <= change.nTxCount) {
+                batch.Erase(std::make_pair('s', it->first));
+                continue;
+            }
+            summary.nTxCount -= change.nTxCount;
+            summary.nReceived -= change.nReceived;
+            summary.nSent -= change.nSent;
+            if (summary.nLastHeight >= change.nFirstHeight) {
+                // the last remaining transaction is found in the address index
+                std::vector<CExtDiskTxPos> vpos;
+                if (!ReadAddrIndex(it->first, vpos, 0, change.nFirstHeight - 1, 0, 1, true))
+                    return false;
+                summary.nLastHeight = vpos.empty() ? summary.nFirstHeight : vpos[0].nHeight;
+            }
+        }
+        batch.Write(std::make_pair('s', it->first), summary);
     }
     return true;
 }
 
-bool CBlockTreeDB::AddAddrIndex(const std::vector<std::pair<uint160, CExtDiskTxPos> > &list) {
+bool CompareOutPointKey::operator()(const COutPoint &a, const COutPoint &b) const {
+    int nCompare = memcmp(a.hash.begin(), b.hash.begin(), a.hash.size());
+    if (nCompare != 0)
+        return nCompare < 0;
+    // the index of the output is serialized little-endian
+    unsigned char na[4], nb[4];
+    WriteLE32(na, a.n);
+    WriteLE32(nb, b.n);
+    return memcmp(na, nb, sizeof(na)) < 0;
+}
+
+static int CompareAddrId(const uint160 &a, const uint160 &b) {
+    return memcmp(a.begin(), b.begin(), a.size());
+}
+
+/** Order the entries of an update like their keys, or find the first entry of an address among them */
+struct CompareAddrIndexUpdateKey
+{
+    bool operator()(const std::pair<uint160, CExtDiskTxPos> &a, const std::pair<uint160, CExtDiskTxPos> &b) const {
+        int nCompare = CompareAddrId(a.first, b.first);
+        return nCompare != 0 ? nCompare < 0 : a.second < b.second;
+    }
+    bool operator()(const std::pair<uint160, COutPoint> &a, const std::pair<uint160, COutPoint> &b) const {
+        int nCompare = CompareAddrId(a.first, b.first);
+        return nCompare != 0 ? nCompare < 0 : CompareOutPointKey()(a.second, b.second);
+    }
+    bool operator()(const std::pair<std::pair<uint160, COutPoint>, CAddrUnspent> &a, const std::pair<std::pair<uint160, COutPoint>, CAddrUnspent> &b) const {
+        return (*this)(a.first, b.first);
+    }
+    bool operator()(const std::pair<uint160, CExtDiskTxPos> &a, const uint160 &addrid) const {
+        return CompareAddrId(a.first, addrid) < 0;
+    }
+    bool operator()(const std::pair<uint160, COutPoint> &a, const uint160 &addrid) const {
+        return CompareAddrId(a.first, addrid) < 0;
+    }
+    bool operator()(const std::pair<std::pair<uint160, COutPoint>, CAddrUnspent> &a, const uint160 &addrid) const {
+        return CompareAddrId(a.first.first, addrid) < 0;
+    }
+};
+
+void CAddrIndexUpdate::swap(CAddrIndexUpdate &other) {
+    vPosAddrid.swap(other.vPosAddrid);
+    vUnspentAdd.swap(other.vUnspentAdd);
+    vUnspentErase.swap(other.vUnspentErase);
+    mapSummary.swap(other.mapSummary);
+}
+
+void CAddrIndexUpdate::Sort() {
+    CompareAddrIndexUpdateKey comp;
+    std::sort(vPosAddrid.begin(), vPosAddrid.end(), comp);
+    std::sort(vUnspentAdd.begin(), vUnspentAdd.end(), comp);
+    std::sort(vUnspentErase.begin(), vUnspentErase.end(), comp);
+}
+
+void CAddrIndexUpdate::GetAddrIndex(const uint160 &addrid, int nMinHeight, int nMaxHeight, std::vector<CExtDiskTxPos> &vpos) const {
+    std::vector<std::pair<uint160, CExtDiskTxPos> >::const_iterator it = std::lower_bound(vPosAddrid.begin(), vPosAddrid.end(), addrid, CompareAddrIndexUpdateKey());
+    for (; it != vPosAddrid.end() && it->first == addrid; ++it) {
+        if ((int)it->second.nHeight >= nMinHeight && (int)it->second.nHeight <= nMaxHeight)
+            vpos.push_back(it->second);
+    }
+}
+
+void CAddrIndexUpdate::GetAddrUnspent(const uint160 &addrid, CAddrUnspentChanges &mapChanges) const {
+    std::vector<std::pair<std::pair<uint160, COutPoint>, CAddrUnspent> >::const_iterator itAdd = std::lower_bound(vUnspentAdd.begin(), vUnspentAdd.end(), addrid, CompareAddrIndexUpdateKey());
+    for (; itAdd != vUnspentAdd.end() && itAdd->first.first == addrid; ++itAdd)
+        mapChanges[itAdd->first.second] = itAdd->second;
+    std::vector<std::pair<uint160, COutPoint> >::const_iterator itErase = std::lower_bound(vUnspentErase.begin(), vUnspentErase.end(), addrid, CompareAddrIndexUpdateKey());
+    for (; itErase != vUnspentErase.end() && itErase->first == addrid; ++itErase)
+        mapChanges[itErase->second] = boost::none;
+}
+
+void CAddrIndexUpdate::Add(const CAddrIndexUpdate &update) {
+    vPosAddrid.insert(vPosAddrid.end(), update.vPosAddrid.begin(), update.vPosAddrid.end());
+    vUnspentAdd.insert(vUnspentAdd.end(), update.vUnspentAdd.begin(), update.vUnspentAdd.end());
+    vUnspentErase.insert(vUnspentErase.end(), update.vUnspentErase.begin(), update.vUnspentErase.end());
+    for (std::map<uint160, CAddrSummary>::const_iterator it = update.mapSummary.begin(); it != update.mapSummary.end(); ++it)
+        mapSummary[it->first].Add(it->second);
+}
+
+bool CAddrIndexDB::WriteAddrIndex(const CAddrIndexUpdate &update, const uint256 &hashBlock, bool fRevert) {
     unsigned char foo[0];
     CLevelDBBatch batch;
-    for (std::vector<std::pair<uint160, CExtDiskTxPos> >::const_iterator it = list.begin(); it != list.end(); ++it) {
-        CHashWriter ss(SER_GETHASH, 0);
-        ss << salt;
-        ss << it->first;
-        batch.Write(std::make_pair(std::make_pair('a', ss.GetHash().GetLow64()), it->second), FLATDATA(foo));
+    // summaries are read before the batch is written, so reverting them finds
+    // the remaining transactions of an address below the reverted blocks
+    if (!BatchAddrSummary(batch, update.mapSummary, fRevert))
+        return false;
+    for (std::vector<std::pair<uint160, CExtDiskTxPos> >::const_iterator it = update.vPosAddrid.begin(); it != update.vPosAddrid.end(); ++it) {
+        if (fRevert)
+            batch.Erase(CAddrIndexKey(it->first, it->second));
+        else
+            batch.Write(CAddrIndexKey(it->first, it->second), FLATDATA(foo));
     }
+    for (std::vector<std::pair<std::pair<uint160, COutPoint>, CAddrUnspent> >::const_iterator it = update.vUnspentAdd.begin(); it != update.vUnspentAdd.end(); ++it)
+        batch.Write(std::make_pair(std::make_pair('u', it->first.first), it->first.second), it->second);
+    for (std::vector<std::pair<uint160, COutPoint> >::const_iterator it = update.vUnspentErase.begin(); it != update.vUnspentErase.end(); ++it)
+        batch.Erase(std::make_pair(std::make_pair('u', it->first), it->second));
+    batch.Write('A', hashBlock);
     return WriteBatch(batch);
 }
 
+bool CAddrIndexDB::ReadAddrIndexBest(uint256 &hashBlock) {
+    return Read('A', hashBlock);
+}
+
+// The address index consists of the transactions ('d'), unspent outputs ('u') and summaries
+// ('s') of addresses, and the last block it covers ('A').
+static const char chAddrIndex[] = { 'd', 'u', 's' };
+
+// Earlier versions keyed the address index by the low 64 bits of a salted hash of the
+// address id, either as ('a', lookupid, pos) or height-ordered as ('h', lookupid, pos),
+// and kept the salt as 'S'. Such entries cannot be converted, because the address id is unknown.
+static const char chLegacyAddrIndex[] = { 'a', 'h' };
+
+/** Erase all entries of db, whose keys start with chPrefix, and add their number to nErased */
+static bool EraseEntries(CLevelDBWrapper &db, char chPrefix, size_t &nErased) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+    pcursor->Seek(std::string(1, chPrefix));
+    // entries have more than the prefix, which distinguishes them from single character keys
+    while (pcursor->Valid() && pcursor->key().size() > 1 && pcursor->key()[0] == chPrefix) {
+        boost::this_thread::interruption_point();
+        std::string strKey = pcursor->key().ToString();
+        batch.Erase(CFlatData(&strKey[0], &strKey[0] + strKey.size()));
+        if (++nBatch >= 10000) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch = CLevelDBBatch();
+            nBatch = 0;
+        }
+        nErased++;
+        pcursor->Next();
+    }
+    if (nBatch > 0)
+        return db.WriteBatch(batch);
+    return true;
+}
+
+/** Copy all entries of dbFrom, whose keys start with chPrefix, to dbTo, and add their number to nCopied */
+static bool CopyEntries(CLevelDBWrapper &dbFrom, CLevelDBWrapper &dbTo, char chPrefix, size_t &nCopied) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(dbFrom.NewIterator());
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+    pcursor->Seek(std::string(1, chPrefix));
+    while (pcursor->Valid() && pcursor->key().size() > 1 && pcursor->key()[0] == chPrefix) {
+        boost::this_thread::interruption_point();
+        std::string strKey = pcursor->key().ToString();
+        std::string strValue = pcursor->value().ToString();
+        batch.Write(CFlatData(&strKey[0], &strKey[0] + strKey.size()), CFlatData(&strValue[0], &strValue[0] + strValue.size()));
+        if (++nBatch >= 10000) {
+            if (!dbTo.WriteBatch(batch))
+                return false;
+            batch = CLevelDBBatch();
+            nBatch = 0;
+        }
+        nCopied++;
+        pcursor->Next();
+    }
+    if (nBatch > 0)
+        return dbTo.WriteBatch(batch);
+    return true;
+}
+
+bool CBlockTreeDB::EraseLegacyAddrIndex() {
+    size_t nErased = 0;
+    for (unsigned int i = 0; i < sizeof(chLegacyAddrIndex); i++)
+        if (!EraseEntries(*this, chLegacyAddrIndex[i], nErased))
+            return false;
+    LogPrintf("%s: erased %u address index entries of an earlier version\n", __func__, (unsigned int)nErased);
+    return Erase('S');
+}
+
+bool CBlockTreeDB::MoveAddrIndex(CAddrIndexDB &db) {
+    // The marker is moved last, and erased here first, so that an interrupted move
+    // is started over, and only the erasing of the moved entries may be left over.
+    uint256 hashBlock;
+    if (Read('A', hashBlock)) {
+        LogPrintf("Moving address index to its own database...\n");
+        if (!db.WipeAddrIndex())
+            return false;
+        size_t nMoved = 0;
+        for (unsigned int i = 0; i < sizeof(chAddrIndex); i++)
+            if (!CopyEntries(*this, db, chAddrIndex[i], nMoved))
+                return false;
+        // The copies are synced before the marker is written, which makes them valid.
+        if (!db.Sync() || !db.Write('A', hashBlock, true) || !Erase('A', true))
+            return false;
+        LogPrintf("%s: moved %u address index entries\n", __func__, (unsigned int)nMoved);
+    }
+    // Indexes of versions, which did not record the last block they cover, are not moved
+    // but rebuilt.
+    size_t nErased = 0;
+    for (unsigned int i = 0; i < sizeof(chAddrIndex); i++)
+        if (!EraseEntries(*this, chAddrIndex[i], nErased))
+            return false;
+    if (nErased > 0)
+        LogPrintf("%s: erased %u address index entries\n", __func__, (unsigned int)nErased);
+    return true;
+}
+
+bool CAddrIndexDB::WipeAddrIndex() {
+    size_t nErased = 0;
+    for (unsigned int i = 0; i < sizeof(chAddrIndex); i++)
+        if (!EraseEntries(*this, chAddrIndex[i], nErased))
+            return false;
+    LogPrintf("%s: erased %u address index entries\n", __func__, (unsigned int)nErased);
+    return Erase('A');
+}
+
+/** Count the entries, whose keys start with chPrefix, with pcursor */
+static uint64_t CountEntries(leveldb::Iterator *pcursor, char chPrefix) {
+    uint64_t nCount = 0;
+    pcursor->Seek(std::string(1, chPrefix));
+    while (pcursor->Valid() && pcursor->key().size() > 1 && pcursor->key()[0] == chPrefix) {
+        boost::this_thread::interruption_point();
+        nCount++;
+        pcursor->Next();
+    }
+    return nCount;
+}
+
+static bool CompareAddrSummaryByTxCount(const std::pair<uint160, CAddrSummary> &a, const std::pair<uint160, CAddrSummary> &b) {
+    return a.second.nTxCount > b.second.nTxCount;
+}
+
+bool CAddrIndexDB::GetAddrIndexStats(CAddrIndexStats &stats, size_t nTop, const CLevelDBSnapshot *psnapshot) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator(psnapshot));
+
+    // The addresses with the most transactions, as counted by their summaries, are kept
+    // in a heap of the nTop largest.
+    std::vector<std::pair<uint160, CAddrSummary> > &vTop = stats.vTop;
+    pcursor->Seek(std::string(1, 's'));
+    while (pcursor->Valid() && pcursor->key().size() > 1 && pcursor->key()[0] == 's') {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint160> key;
+        CAddrSummary summary;
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            ssKey >> key;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> summary;
+        } catch (const std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        stats.nAddresses++;
+        if (nTop > 0 && (vTop.size() < nTop || summary.nTxCount > vTop.front().second.nTxCount)) {
+            if (vTop.size() == nTop) {
+                std::pop_heap(vTop.begin(), vTop.end(), CompareAddrSummaryByTxCount);
+                vTop.pop_back();
+            }
+            vTop.push_back(std::make_pair(key.second, summary));
+            std::push_heap(vTop.begin(), vTop.end(), CompareAddrSummaryByTxCount);
+        }
+        pcursor->Next();
+    }
+    std::sort_heap(vTop.begin(), vTop.end(), CompareAddrSummaryByTxCount);
+
+    stats.nHistoryEntries = CountEntries(pcursor.get(), 'd');
+    stats.nUnspentEntries = CountEntries(pcursor.get(), 'u');
+
+    stats.nHistorySize = EstimateSize('d', 'e');
+    stats.nUnspentSize = EstimateSize('u', 'v');
+    stats.nSummarySize = EstimateSize('s', 't');
+    return true;
+}
+
+void CAddrIndexDB::CompactAddrIndex() {
+    for (unsigned int i = 0; i < sizeof(chAddrIndex); i++) {
+        boost::this_thread::interruption_point();
+        CompactRange(chAddrIndex[i], (char)(chAddrIndex[i] + 1));
+    }
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
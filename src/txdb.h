@@ -9,11 +9,19 @@
 #include "leveldbwrapper.h"
 #include "main.h"
 
+#include <limits>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/function.hpp>
+#include <boost/optional.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CAddrIndexDB;
 class CCoins;
 class uint256;
 
@@ -37,6 +45,113 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Write the dirty entries of mapCoins and hashBlock in one batch, leaving mapCoins unchanged
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+};
+
+/**
+ * CCoinsView between the coins cache and the coin database, which writes the coins flushed
+ * into it to the database on a background thread, so that flushing the cache does not wait for
+ * the database. The coins are read from memory until their write completes. As the best block
+ * is written in the same batch as the coins, the database only moves on to it once all of them
+ * are written. A flush, while the previous one is still being written, waits for it, so that
+ * at most one flush is held in memory next to the cache, which its owner counts against the
+ * memory budget of the cache through DynamicMemoryUsage.
+ */
+class CCoinsViewDBWriter : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB *pdb;
+    mutable boost::mutex cs;
+    mutable boost::condition_variable cond;
+    //! coins being written, the best block they belong to, and the memory they take
+    CCoinsMap mapWriting;
+    uint256 hashWriting;
+    size_t nWritingUsage;
+    bool fWriting;
+    //! called on the writing thread, once the coins being written are written
+    boost::function<void()> fnWritten;
+    //! set when a write failed; its coins are kept, and no more are accepted
+    bool fFailed;
+    bool fStop;
+    boost::thread thread;
+
+    void ThreadWrite();
+
+public:
+    //! Reads go to baseIn, writes to pdbIn, which must be baseIn or below it
+    CCoinsViewDBWriter(CCoinsView *baseIn, CCoinsViewDB *pdbIn);
+    ~CCoinsViewDBWriter();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetStats(CCoinsStats &stats) const;
+
+    //! Wait until the coins flushed so far are written. Returns false if the write failed.
+    bool Sync() const;
+
+    /**
+     * Call fn on the writing thread, once the coins flushed so far are written, or now, if they are.
+     * It is not called if their write fails. Sync does not wait for it, so that fn may take locks,
+     * which the caller of Sync holds.
+     */
+    void CallWhenWritten(const boost::function<void()> &fn);
+
+    //! Memory taken by the coins being written
+    size_t DynamicMemoryUsage() const;
+};
+
+/** Order outpoints like their serialization in the keys of the address index */
+struct CompareOutPointKey
+{
+    bool operator()(const COutPoint &a, const COutPoint &b) const;
+};
+
+/** Changes to the unspent outputs of an address by outpoint: the output, if it is added, or NULL, if it is erased */
+typedef std::map<COutPoint, boost::optional<CAddrUnspent>, CompareOutPointKey> CAddrUnspentChanges;
+
+/** Changes of one or more blocks to the address index, which are written at once */
+struct CAddrIndexUpdate
+{
+    //! transactions of the blocks by address
+    std::vector<std::pair<uint160, CExtDiskTxPos> > vPosAddrid;
+    //! unspent outputs to add, before those in vUnspentErase are removed
+    std::vector<std::pair<std::pair<uint160, COutPoint>, CAddrUnspent> > vUnspentAdd;
+    std::vector<std::pair<uint160, COutPoint> > vUnspentErase;
+    //! changes to the address summaries
+    std::map<uint160, CAddrSummary> mapSummary;
+
+    //! Append the changes of the following blocks
+    void Add(const CAddrIndexUpdate &update);
+    //! Number of entries to write
+    size_t GetCount() const { return vPosAddrid.size() + vUnspentAdd.size() + vUnspentErase.size() + mapSummary.size(); }
+    void swap(CAddrIndexUpdate &other);
+
+    //! Sort the entries in the order of their keys, so that those of an address can be looked up
+    void Sort();
+    //! Append the transactions of addrid within the height range [nMinHeight, nMaxHeight] to vpos. Requires Sort.
+    void GetAddrIndex(const uint160 &addrid, int nMinHeight, int nMaxHeight, std::vector<CExtDiskTxPos> &vpos) const;
+    //! Apply the changes to the unspent outputs of addrid to mapChanges. Requires Sort.
+    void GetAddrUnspent(const uint160 &addrid, CAddrUnspentChanges &mapChanges) const;
+};
+
+/** Statistics of the address index */
+struct CAddrIndexStats
+{
+    uint64_t nAddresses;        //! number of addresses with a summary
+    uint64_t nHistoryEntries;   //! number of transaction entries
+    uint64_t nUnspentEntries;   //! number of unspent output entries
+    //! approximate sizes on disk of the transaction entries, unspent output entries and summaries
+    uint64_t nHistorySize;
+    uint64_t nUnspentSize;
+    uint64_t nSummarySize;
+    //! the addresses with the most transaction entries, most first
+    std::vector<std::pair<uint160, CAddrSummary> > vTop;
+
+    CAddrIndexStats() : nAddresses(0), nHistoryEntries(0), nUnspentEntries(0), nHistorySize(0), nUnspentSize(0), nSummarySize(0) {}
 };
 
 /** Access to the block database (blocks/index/) */
@@ -45,7 +160,6 @@ class CBlockTreeDB : public CLevelDBWrapper
 public:
     CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 private:
-    uint256 salt;
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
 public:
@@ -58,11 +172,64 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
-    bool ReadAddrIndex(uint160 addrid, std::vector<CExtDiskTxPos> &list);
-    bool AddAddrIndex(const std::vector<std::pair<uint160, CExtDiskTxPos> > &list);
+    bool EraseLegacyAddrIndex();
+    //! Move the address index, which earlier versions kept in this database, to db
+    bool MoveAddrIndex(CAddrIndexDB &db);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
 };
 
+/** Access to the address index database (indexes/addr/) */
+class CAddrIndexDB : public CLevelDBWrapper
+{
+public:
+    CAddrIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CAddrIndexDB(const CAddrIndexDB&);
+    void operator=(const CAddrIndexDB&);
+    bool BatchAddrSummary(CLevelDBBatch &batch, const std::map<uint160, CAddrSummary> &mapSummary, bool fRevert);
+public:
+    /**
+     * Read the address index entries of addrid within the height range [nMinHeight, nMaxHeight],
+     * in the order of the block chain, or newest first, if fReverse is set. The first nSkip
+     * matching entries are skipped, and at most nLimit entries are appended to list. Reads
+     * of the address index see the state of psnapshot, if given.
+     */
+    bool ReadAddrIndex(uint160 addrid, std::vector<CExtDiskTxPos> &list,
+                       int nMinHeight = 0, int nMaxHeight = std::numeric_limits<int>::max(),
+                       size_t nSkip = 0, size_t nLimit = std::numeric_limits<size_t>::max(), bool fReverse = false,
+                       const CLevelDBSnapshot *psnapshot = NULL);
+    /**
+     * Read the address index entries of several addresses like those of one, with each transaction
+     * listed once. The ordered entries in pvPending, if given, belong to blocks after those of the
+     * database, and are selected as if they followed its entries.
+     */
+    bool ReadAddrIndex(const std::vector<uint160> &vAddrId, std::vector<CExtDiskTxPos> &list,
+                       int nMinHeight = 0, int nMaxHeight = std::numeric_limits<int>::max(),
+                       size_t nSkip = 0, size_t nLimit = std::numeric_limits<size_t>::max(), bool fReverse = false,
+                       const CLevelDBSnapshot *psnapshot = NULL, const std::vector<CExtDiskTxPos> *pvPending = NULL);
+    /**
+     * Read the unspent outputs of addrid from nMinHeight on, in the order of their outpoints,
+     * starting after pafter, if given. At most nLimit outputs are appended to list. The changes
+     * in pchanges, if given, are applied to those of the database.
+     */
+    bool ReadAddrUnspentIndex(const uint160 &addrid, std::vector<std::pair<COutPoint, CAddrUnspent> > &list,
+                              int nMinHeight, const COutPoint *pafter, size_t nLimit,
+                              const CLevelDBSnapshot *psnapshot = NULL, const CAddrUnspentChanges *pchanges = NULL);
+    bool ReadAddrSummary(const uint160 &addrid, CAddrSummary &summary, const CLevelDBSnapshot *psnapshot = NULL);
+    /**
+     * Apply the changes of blocks to all parts of the address index, or undo them, if fRevert
+     * is set, and record hashBlock as the last block covered by the index, in a single batch.
+     */
+    bool WriteAddrIndex(const CAddrIndexUpdate &update, const uint256 &hashBlock, bool fRevert = false);
+    bool ReadAddrIndexBest(uint256 &hashBlock);
+    //! Erase the whole address index
+    bool WipeAddrIndex();
+    //! Collect statistics of the address index as of psnapshot, with the nTop addresses, which have the most entries
+    bool GetAddrIndexStats(CAddrIndexStats &stats, size_t nTop, const CLevelDBSnapshot *psnapshot = NULL);
+    //! Compact the address index on disk, so that later reads and writes of it touch fewer files
+    void CompactAddrIndex();
+};
+
 #endif // BITCOIN_TXDB_H
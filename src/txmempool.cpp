@@ -419,7 +419,7 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
-bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
+bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, const std::vector<uint160> &vAddrId)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
@@ -432,6 +432,13 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
         nTransactionsUpdated++;
         totalTxSize += entry.GetTxSize();
+        if (!vAddrId.empty()) {
+            std::vector<uint160> &vTxAddr = mapTxAddr[hash];
+            BOOST_FOREACH(const uint160 &addrid, vAddrId) {
+                if (setAddrTx.insert(std::make_pair(addrid, hash)).second)
+                    vTxAddr.push_back(addrid);
+            }
+        }
     }
     return true;
 }
@@ -473,6 +480,12 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             }
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
+            std::map<uint256, std::vector<uint160> >::iterator itAddr = mapTxAddr.find(hash);
+            if (itAddr != mapTxAddr.end()) {
+                BOOST_FOREACH(const uint160 &addrid, itAddr->second)
+                    setAddrTx.erase(std::make_pair(addrid, hash));
+                mapTxAddr.erase(itAddr);
+            }
 
             removed.push_back(tx);
             totalTxSize -= mapTx[hash].GetTxSize();
@@ -554,6 +567,8 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    setAddrTx.clear();
+    mapTxAddr.clear();
     totalTxSize = 0;
     ++nTransactionsUpdated;
 }
@@ -627,6 +642,10 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(tx.vin.size() > it->second.n);
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
+    for (set<pair<uint160, uint256> >::const_iterator it = setAddrTx.begin(); it != setAddrTx.end(); it++) {
+        assert(mapTx.count(it->second));
+        assert(mapTxAddr.count(it->second));
+    }
 
     assert(totalTxSize == checkTotal);
 }
@@ -641,6 +660,14 @@ void CTxMemPool::queryHashes(vector<uint256>& vtxid)
         vtxid.push_back((*mi).first);
 }
 
+void CTxMemPool::queryHashesByAddr(const uint160& addrid, vector<uint256>& vtxid) const
+{
+    LOCK(cs);
+    set<pair<uint160, uint256> >::const_iterator it = setAddrTx.lower_bound(make_pair(addrid, uint256(0)));
+    for (; it != setAddrTx.end() && it->first == addrid; ++it)
+        vtxid.push_back(it->second);
+}
+
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
@@ -32,6 +32,7 @@
 
 #include <algorithm>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 
@@ -548,6 +549,33 @@ bool TruncateFile(FILE *file, unsigned int length) {
 #endif
 }
 
+/**
+ * Map the whole of an open file read-only into memory. The mapping stays valid after the file
+ * is closed. Returns NULL if the file is empty, mapping fails, or the platform lacks support.
+ */
+const char *MapFileReadOnly(FILE *file, size_t &nSize) {
+    nSize = 0;
+#if defined(WIN32)
+    return NULL;
+#else
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || st.st_size <= 0)
+        return NULL;
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    nSize = st.st_size;
+    return (const char*)p;
+#endif
+}
+
+void UnmapFile(const char *p, size_t nSize) {
+#if !defined(WIN32)
+    if (p)
+        munmap((void*)p, nSize);
+#endif
+}
+
 /**
  * this function tries to raise the file descriptor limit to the requested number.
  * It returns the actual file descriptor limit (which may be more or less than nMinFD)